@@ -13,6 +13,7 @@
 #include <script/functions/functions.hpp>
 #include <script/profiler.hpp>
 #include <data/format/formats.hpp>
+#include <gfx/generated_image.hpp>
 #include <wx/process.h>
 #include <wx/wfstream.h>
 
@@ -133,6 +134,7 @@ void CLISetInterface::showUsage() {
   cli << _("   :load <setfile>     Load a different set file.\n");
   cli << _("   :quit               Exit the MSE command line interface.\n");
   cli << _("   :reset              Clear all local variable definitions.\n");
+  cli << _("   :info               Show information about the set and the image caches.\n");
   cli << _("   :pwd                Print the current working directory.\n");
   cli << _("   :cd                 Change the working directory.\n");
   cli << _("   :! <command>        Perform a shell command.\n");
@@ -175,6 +177,8 @@ void CLISetInterface::handleCommand(const String& command) {
         } else {
           cli << _("No set loaded") << ENDL;
         }
+        showImageCacheStats(_("images:   "), packaged_image_cache_stats());
+        showImageCacheStats(_("blends:   "), generated_image_cache_stats());
       } else if (before == _(":c") || before == _(":cd")) {
         if (arg.empty()) {
           cli.show_message(MESSAGE_ERROR,_("Give a new working directory."));
@@ -239,6 +243,11 @@ void CLISetInterface::handleCommand(const String& command) {
   }
 }
 
+void CLISetInterface::showImageCacheStats(const String& name, const ImageCacheStats& stats) {
+  cli << name << String::Format(_("%d hits, %d misses, %d images using %.1f MB"),
+                                (int)stats.hits, (int)stats.misses, (int)stats.images, stats.bytes / (1024.0 * 1024.0)) << ENDL;
+}
+
 #if USE_SCRIPT_PROFILING
   void CLISetInterface::showProfilingStats(const FunctionProfile& item, int level) {
     // show parent
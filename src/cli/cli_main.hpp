@@ -13,6 +13,8 @@
 #include <data/export_template.hpp>
 #include <script/profiler.hpp>
 
+struct ImageCacheStats;
+
 // ----------------------------------------------------------------------------- : Command line interface
 
 class CLISetInterface : public SetView {
@@ -31,6 +33,7 @@ private:
   void showWelcome();
   void showUsage();
   void handleCommand(const String& command);
+  void showImageCacheStats(const String& name, const ImageCacheStats& stats);
   #if USE_SCRIPT_PROFILING
     void showProfilingStats(const FunctionProfile& parent, int level = 0);
   #endif
@@ -606,6 +606,7 @@ private:
 
 
 void export_apprentice(Window* parent, const SetP& set) {
+  set->updateDelayed();
   ApprenticeExportWindow wnd(parent, set);
   wnd.ShowModal();
 }
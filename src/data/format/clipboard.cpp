@@ -141,6 +141,9 @@ KeywordP KeywordDataObject::getKeyword(const SetP& set) {
 // ----------------------------------------------------------------------------- : Card on clipboard
 
 CardsOnClipboard::CardsOnClipboard(const SetP& set, const vector<CardP>& cards) {
+  FOR_EACH_CONST(card, cards) {
+    set->updateDelayed(card); // the copy includes the values of the cards
+  }
   // Conversion to text format
     // TODO
     //Add( new TextDataObject(_("card"))) 
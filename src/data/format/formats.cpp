@@ -50,6 +50,7 @@ void export_set(Set& set, const String& filename, size_t format_index, bool is_c
   if (!format.canExport(*set.game)) {
     throw InternalError(_("File format doesn't apply to set"));
   }
+  set.updateDelayed(); // exports use the values of all cards
   format.exportSet(set, filename, is_copy);
 }
 
@@ -70,6 +70,7 @@ void export_images(const SetP& set, const vector<CardP>& cards,
                    const String& path, const String& filename_template, FilenameConflicts conflicts)
 {
   wxBusyCursor busy;
+  set->updateDelayed(); // filenames can use the values of other cards
   // Script
   ScriptP filename_script = parse(filename_template, nullptr, true);
   // Path
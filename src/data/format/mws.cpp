@@ -57,6 +57,7 @@ void export_mws(Window* parent, const SetP& set) {
   if (!set->game->isMagic()) {
     throw Error(_("Can only export Magic sets to Magic Workstation"));
   }
+  set->updateDelayed();
   
   // Select filename
   String name = wxFileSelector(_("Export to file"),settings.default_export_dir,_(""),_(""),
@@ -9,10 +9,9 @@
 #include <util/prec.hpp>
 #include <data/keyword.hpp>
 #include <util/tagged_string.hpp>
-#include <unordered_map>
 #include <unordered_set>
 
-class KeywordTrie;
+class KeywordMatcher;
 DECLARE_POINTER_TYPE(KeywordParamValue);
 class Value;
 DECLARE_DYNAMIC_ARG(Value*, value_being_updated);
@@ -208,83 +207,142 @@ void Keyword::prepare(const vector<KeywordParamP>& param_types, bool force) {
   valid = !match_re.matches(_(""));
 }
 
-// ----------------------------------------------------------------------------- : KeywordTrie
+// ----------------------------------------------------------------------------- : KeywordMatcher
 
-namespace std {
-  template <> struct hash<wxUniChar> {
-    inline size_t operator () (wxUniChar x) const {
-      return std::hash<wxUniChar::value_type>()(x.GetValue());
-    }
-  };
-}
-
-/// A node in a trie to match keywords
-/* The trie is used to speed up matching, by quickly finding candidate keywords.
-*/
-class KeywordTrie {
+/// An Aho-Corasick automaton to quickly find candidate keywords
+/* Each keyword is reduced to a piece of literal text that must appear in the input for the keyword to match,
+ * this is the first text before a parameter, or the text after only parameters.
+ * The automaton finds all of these pieces in a single pass over the input.
+ * This is only an optimization to not have to match lots of regexes, the actual matching is done by keyword_matches.
+ */
+class KeywordMatcher {
 public:
-  KeywordTrie();
-  ~KeywordTrie();
+  KeywordMatcher();
+  
+  /// Add a keyword that is a candidate whenever text appears in the input
+  void add(const String& text, const Keyword* keyword);
+  /// Compute the failure links, must be called after adding and before matching
+  void build();
+  /// Find all keywords whose text appears in the given string, tags are skipped
+  unordered_set<const Keyword*> possible_matches(const String& tagged_str) const;
   
-  unordered_map<wxUniChar, unique_ptr<KeywordTrie>> children; ///< children after a given character
-  KeywordTrie* on_any_star; ///< children on /.*/ (owned or this)
-  vector<const Keyword*> finished; ///< keywords that end in this node
+  bool built; ///< Has build been called since the last add?
   
-  /// Insert nodes representing the given character
-  /** return the node where the evaluation will be after matching the character */
-  KeywordTrie* insert(wxUniChar match);
-  /// Insert nodes representing the given string
-  /** return the node where the evaluation will be after matching the string */
-  KeywordTrie* insert(const String& match);
-
-  /// Insert nodes representing the regex /.*/
-  /** return the node where the evaluation will be after matching that regex */
-  KeywordTrie* insertAnyStar();
+private:
+  struct Node {
+    vector<pair<Char,unsigned int>> next;    ///< Children, sorted by character
+    unsigned int                    fail;    ///< Node for the longest proper suffix that is in the trie
+    vector<const Keyword*>          matches; ///< Keywords whose text is a suffix of the text of this node
+  };
+  vector<Node> nodes; ///< nodes[0] is the root
+  
+  /// Child of a node for a character, 0 if there is none (the root is never a child)
+  unsigned int child(unsigned int node, Char c) const;
 };
 
-
-KeywordTrie::KeywordTrie()
-  : on_any_star(nullptr)
+KeywordMatcher::KeywordMatcher()
+  : built(false)
+  , nodes(1)
 {}
-KeywordTrie::~KeywordTrie() {
-  if (on_any_star != this) delete on_any_star;
+
+unsigned int KeywordMatcher::child(unsigned int node, Char c) const {
+  const vector<pair<Char,unsigned int>>& next = nodes[node].next;
+  auto it = lower_bound(next.begin(), next.end(), make_pair(c, 0u));
+  return it != next.end() && it->first == c ? it->second : 0;
 }
 
-KeywordTrie* KeywordTrie::insert(wxUniChar c) {
-  #if USE_CASE_INSENSITIVE_KEYWORDS
-    c = toLower(c); // case insensitive matching
-  #endif
-  unique_ptr<KeywordTrie>& child = children[c];
-  if (!child) child.reset(new KeywordTrie);
-  return child.get();
-}
-KeywordTrie* KeywordTrie::insert(const String& match) {
-  KeywordTrie* cur = this;
-  for (wxUniChar c : match) {
-    cur = cur->insert(c);
+void KeywordMatcher::add(const String& text, const Keyword* keyword) {
+  unsigned int cur = 0;
+  for (wxUniChar uc : text) {
+    Char c = uc;
+    #if USE_CASE_INSENSITIVE_KEYWORDS
+      c = toLower(c); // case insensitive matching
+    #endif
+    unsigned int next = child(cur, c);
+    if (!next) {
+      next = (unsigned int)nodes.size();
+      vector<pair<Char,unsigned int>>& children = nodes[cur].next;
+      children.insert(lower_bound(children.begin(), children.end(), make_pair(c, 0u)), make_pair(c, next));
+      nodes.emplace_back(); // invalidates children
+    }
+    cur = next;
   }
-  return cur;
+  nodes[cur].matches.push_back(keyword);
+  built = false;
 }
 
-KeywordTrie* KeywordTrie::insertAnyStar() {
-  if (!on_any_star) on_any_star = new KeywordTrie();
-  on_any_star->on_any_star = on_any_star; // circular reference to itself
-  return on_any_star;
+void KeywordMatcher::build() {
+  // breadth first, so the failure node of a node is done before the node itself
+  nodes[0].fail = 0;
+  vector<unsigned int> queue;
+  FOR_EACH_CONST(n, nodes[0].next) {
+    nodes[n.second].fail = 0;
+    queue.push_back(n.second);
+  }
+  for (size_t i = 0 ; i < queue.size() ; ++i) {
+    unsigned int node = queue[i];
+    Node& cur = nodes[node];
+    // all keywords matching at the failure node also match here
+    const vector<const Keyword*>& inherited = nodes[cur.fail].matches;
+    cur.matches.insert(cur.matches.end(), inherited.begin(), inherited.end());
+    FOR_EACH_CONST(n, cur.next) {
+      unsigned int fail = cur.fail;
+      while (fail && !child(fail, n.first)) fail = nodes[fail].fail;
+      unsigned int fail_child = child(fail, n.first);
+      nodes[n.second].fail = fail_child != n.second ? fail_child : 0;
+      queue.push_back(n.second);
+    }
+  }
+  built = true;
 }
 
+// Collect possible matching keywords
+/* First step in matching is to run over the string, and use the automaton to find keywords that *potentially* appear in it.
+ */
+unordered_set<const Keyword*> KeywordMatcher::possible_matches(const String& tagged_str) const {
+  assert(built);
+  unordered_set<const Keyword*> possible_matches;
+  // the matches of a node only have to be added the first time it is reached
+  vector<bool> reached(nodes.size(), false);
+  unsigned int state = 0;
+  for (String::const_iterator it = tagged_str.begin(); it != tagged_str.end();) {
+    wxUniChar c = *it;
+    // tag?
+    if (c == '<') {
+      it = skip_tag(it, tagged_str.end());
+    } else {
+      ++it;
+      c = toLower(c); // case insensitive matching
+      // follow failure links until the character can be matched
+      unsigned int next = child(state, c);
+      while (!next && state) {
+        state = nodes[state].fail;
+        next = child(state, c);
+      }
+      state = next;
+      if (!reached[state]) {
+        reached[state] = true;
+        possible_matches.insert(nodes[state].matches.begin(), nodes[state].matches.end());
+      }
+    }
+  }
+  return possible_matches;
+}
 
 // ----------------------------------------------------------------------------- : KeywordDatabase
 
 IMPLEMENT_DYNAMIC_ARG(KeywordUsageStatistics*, keyword_usage_statistics, nullptr);
 
 KeywordDatabase::KeywordDatabase()
-  : root(nullptr)
 {}
-// Note: has to be here because in the header KeywordTrie is not defined
+// Note: has to be here because in the header KeywordMatcher is not defined
 KeywordDatabase::~KeywordDatabase() {}
 
 void KeywordDatabase::clear() {
-  root.reset();
+  matcher.reset();
+  lock_guard<mutex> lock(paragraph_cache_mutex);
+  paragraph_cache.clear();
+  paragraph_cache_index.clear();
 }
 
 void KeywordDatabase::add(const vector<KeywordP>& kws) {
@@ -295,13 +353,10 @@ void KeywordDatabase::add(const vector<KeywordP>& kws) {
 
 void KeywordDatabase::add(const Keyword& kw) {
   if (kw.match.empty() || !kw.valid) return; // can't handle empty keywords
-  // Create root
-  if (!root) {
-    root = make_unique<KeywordTrie>();
-    root->on_any_star = root.get();
+  if (!matcher) {
+    matcher = make_unique<KeywordMatcher>();
   }
-  KeywordTrie* cur = root->insertAnyStar();
-  // Add to trie
+  // Find the text to look for
   String text; // normal text
   size_t param = 0;
   bool only_star = true;
@@ -315,27 +370,26 @@ void KeywordDatabase::add(const Keyword& kw) {
         kw.parameters[param]->eat_separator_after(kw.match, i);
       }
       ++param;
-      // match anything
-      cur = cur->insert(text);
-      text.clear();
-      cur = cur->insertAnyStar();
       // enough?
       if (!only_star) {
         // If we have matched anything specific, this is a good time to stop
-        // it doesn't really matter how long we go on, since the trie is only used
+        // it doesn't really matter how long we go on, since the automaton is only used
         // as an optimization to not have to match lots of regexes.
-        // As an added bonus, we get a better behaviour of matching earlier keywords first.
         break;
       }
+      // the parameter matches anything
+      text.clear();
     } else {
       text += c;
       i++;
       only_star = false;
     }
   }
-  cur = cur->insert(text);
-  // now cur is the trie after matching the keyword anywhere in the input text
-  cur->finished.push_back(&kw);
+  matcher->add(text, &kw);
+}
+
+void KeywordDatabase::prepare() {
+  if (matcher) matcher->build();
 }
 
 void KeywordDatabase::prepare_parameters(const vector<KeywordParamP>& ps, const vector<KeywordP>& kws) {
@@ -344,77 +398,8 @@ void KeywordDatabase::prepare_parameters(const vector<KeywordParamP>& ps, const
   }
 }
 
-#ifdef _DEBUG
-void dump(int i, const KeywordTrie* t) {
-  FOR_EACH(c, t->children) {
-    wxLogDebug(String(i, _(' ')) + c.first + _("     ") + String::Format(_("%p"), c.second.get()));
-    dump(i + 2, c.second.get());
-  }
-  if (t->on_any_star) {
-    wxLogDebug(String(i, _(' ')) + _(".*") + _("     ") + String::Format(_("%p"), t->on_any_star));
-    if (t->on_any_star != t) dump(i + 2, t->on_any_star);
-  }
-}
-#endif
-
 // ----------------------------------------------------------------------------- : KeywordDatabase : matching
 
-// transitive closure of a state, follow all on_any_star links
-void closure(vector<const KeywordTrie*>& state) {
-  for (size_t j = 0 ; j < state.size() ; ++j) {
-    if (state[j]->on_any_star && state[j]->on_any_star != state[j]) {
-      state.push_back(state[j]->on_any_star);
-    }
-  }
-}
-
-void step_state(vector<const KeywordTrie*>& state, wxUniChar c) {
-  vector<const KeywordTrie*> next;
-  for(auto kt : state) {
-    auto it = kt->children.find(c);
-    if (it != kt->children.end()) {
-      next.push_back(it->second.get());
-    }
-    // TODO: on any star first or last?
-    if (kt->on_any_star) {
-      next.push_back(kt->on_any_star);
-    }
-  }
-  swap(state,next);
-}
-
-// Collect possible matching keywords
-/* First step in matching is to run over the string, and use the trie to find keywords that *potentially* appear in it.
- */
-unordered_set<Keyword const*> possible_matches(String const& tagged_str, KeywordTrie const* trie_root) {
-  unordered_set<const Keyword*> possible_matches;
-  if (!trie_root) return possible_matches;
-
-  vector<const KeywordTrie*> state;
-  state.push_back(trie_root);
-
-  for (String::const_iterator it = tagged_str.begin(); it != tagged_str.end();) {
-    wxUniChar c = *it;
-    // tag?
-    if (c == '<') {
-      it = skip_tag(it, tagged_str.end());
-    } else {
-      ++it;
-      c = toLower(c); // case insensitive matching
-      // find 'next' trie node set matching c
-      step_state(state, c);
-      closure(state);
-      // matches
-      for (auto kt : state) {
-        for (auto kw : kt->finished) {
-          possible_matches.insert(kw);
-        }
-      }
-    }
-  }
-  return possible_matches;
-}
-
 struct KeywordMatch {
   Keyword const* keyword;
   // match in (substring of) the untagged string
@@ -464,6 +449,58 @@ vector<KeywordMatch> keyword_matches(const String& untagged_str, unordered_set<K
   return out;
 }
 
+struct KeywordDatabase::ParagraphMatches {
+  String               text;    ///< The line, the regex results of the matches refer to this string
+  vector<KeywordMatch> matches; ///< Sorted matches, with positions in the line
+};
+
+KeywordDatabase::ParagraphsMatches KeywordDatabase::findMatches(const String& untagged, const Value* key) const {
+  ParagraphsMatches previous, paragraphs;
+  if (key) {
+    lock_guard<mutex> lock(paragraph_cache_mutex);
+    auto it = paragraph_cache_index.find(key);
+    if (it != paragraph_cache_index.end()) previous = it->second->second;
+  }
+  // keywords are matched line by line
+  size_t start = 0;
+  while (true) {
+    size_t end = untagged.find(_('\n'), start);
+    String text = untagged.substr(start, end == String::npos ? String::npos : end - start);
+    shared_ptr<const ParagraphMatches> paragraph;
+    FOR_EACH_CONST(p, previous) {
+      if (p->text == text) {
+        paragraph = p;
+        break;
+      }
+    }
+    if (!paragraph) {
+      shared_ptr<ParagraphMatches> new_paragraph = make_shared<ParagraphMatches>();
+      new_paragraph->text = text;
+      new_paragraph->matches = keyword_matches(new_paragraph->text, matcher->possible_matches(new_paragraph->text));
+      paragraph = new_paragraph;
+    }
+    paragraphs.push_back(paragraph);
+    if (end == String::npos) break;
+    start = end + 1;
+  }
+  if (key) {
+    lock_guard<mutex> lock(paragraph_cache_mutex);
+    auto it = paragraph_cache_index.find(key);
+    if (it != paragraph_cache_index.end()) {
+      it->second->second = paragraphs;
+      paragraph_cache.splice(paragraph_cache.begin(), paragraph_cache, it->second);
+    } else {
+      paragraph_cache.emplace_front(key, paragraphs);
+      paragraph_cache_index.emplace(key, paragraph_cache.begin());
+      if (paragraph_cache.size() > MAX_PARAGRAPH_CACHE) {
+        paragraph_cache_index.erase(paragraph_cache.back().first);
+        paragraph_cache.pop_back();
+      }
+    }
+  }
+  return paragraphs;
+}
+
 
 
 tuple<bool,String::const_iterator> expand_keyword(String::const_iterator it, String::const_iterator end, KeywordMatch const& match, char expand_type, String& out, KeywordExpandOptions const& options);
@@ -783,14 +820,20 @@ String KeywordDatabase::expand(const String& text, KeywordExpandOptions const& o
   String tagged = remove_keyword_tags(text);
 
   // any keywords in database?
-  if (!root) return tagged;
-
-  // Find potential matches
-  auto possible_matches = ::possible_matches(tagged, root.get());
+  if (!matcher) return tagged;
 
-  // Refine
+  // Find matches, the paragraphs own the strings that the matches refer to
   String untagged = untag_no_escape(tagged);
-  auto matches = keyword_matches(untagged, possible_matches);
+  ParagraphsMatches paragraphs = findMatches(untagged, options.stat_key);
+  vector<KeywordMatch> matches;
+  size_t paragraph_start = 0;
+  FOR_EACH_CONST(p, paragraphs) {
+    FOR_EACH_CONST(m, p->matches) {
+      matches.push_back(m);
+      matches.back().pos += paragraph_start;
+    }
+    paragraph_start += p->text.size() + 1; // and the newline
+  }
   
   // Expand
   String result = expand_keywords(tagged, matches, options);
@@ -13,12 +13,13 @@
 #include <util/dynamic_arg.hpp>
 #include <util/regex.hpp>
 #include <data/filter.hpp>
+#include <mutex>
 
 DECLARE_POINTER_TYPE(KeywordParam);
 DECLARE_POINTER_TYPE(KeywordMode);
 DECLARE_POINTER_TYPE(Keyword);
 DECLARE_POINTER_TYPE(ParamReferenceType);
-class KeywordTrie;
+class KeywordMatcher;
 class Value;
 
 // ----------------------------------------------------------------------------- : Keyword parameters
@@ -156,6 +157,8 @@ public:
   void add(const vector<KeywordP>&);
   /// Add a keyword to be matched
   void add(const Keyword&);
+  /// Prepare the database for matching, must be called after the keywords are added
+  void prepare();
   
   /// Prepare the parameters and match regex for a list of keywords
   static void prepare_parameters(const vector<KeywordParamP>&, const vector<KeywordP>&);
@@ -163,7 +166,7 @@ public:
   /// Clear the database
   void clear();
   /// Is the database empty?
-  inline bool empty() const { return !root; }
+  inline bool empty() const { return !matcher; }
   
   /// Expand/update all keywords in the given string.
   /** @param options.expand_default script function indicating whether reminder text should be shown by default
@@ -175,7 +178,24 @@ public:
   String expand(const String& text, const KeywordExpandOptions&) const;
   
 private:
-  unique_ptr<KeywordTrie> root; ///< Data structure for finding keywords
+  unique_ptr<KeywordMatcher> matcher; ///< Data structure for finding keywords
+  
+  /// The keyword matches in a single line of text
+  struct ParagraphMatches;
+  typedef vector<shared_ptr<const ParagraphMatches>> ParagraphsMatches;
+  /// The matches in each line of the text most recently expanded for a value, most recently used first
+  /** When a value is edited, only the lines that changed have to be matched again.
+   *  Stale entries of values that no longer exist are harmless, since lines are only reused when the text is the same,
+   *  they are dropped when the cache is full.
+   */
+  typedef list<pair<const Value*, ParagraphsMatches>> ParagraphCache;
+  static const size_t MAX_PARAGRAPH_CACHE = 5000;
+  mutable ParagraphCache                                        paragraph_cache;
+  mutable unordered_map<const Value*, ParagraphCache::iterator> paragraph_cache_index;
+  mutable mutex                                                 paragraph_cache_mutex;
+  
+  /// Find the keyword matches in each line of an untagged string, reusing lines from the last text of the same value
+  ParagraphsMatches findMatches(const String& untagged, const Value* key) const;
   
   /// (try to) expand a single keyword
   /** If the keyword matches:
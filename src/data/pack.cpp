@@ -360,6 +360,7 @@ void PackInstance::generate_one_random(vector<CardP>* out) {
 // ----------------------------------------------------------------------------- : PackGenerator
 
 void PackGenerator::reset(const SetP& set, int seed) {
+  set->updateDelayed(); // packs select cards by their values
   this->set = set;
   gen.seed((unsigned)seed);
   max_depth = 0;
@@ -25,6 +25,20 @@
 
 // ----------------------------------------------------------------------------- : Set
 
+/// The cards ordered by some criterion, see positionOfCard
+struct Set::CardOrder {
+  /// The order value of a card, with the inputs that the order_by and filter functions read
+  struct CardKey {
+    String     value;
+    bool       keep;
+    ScriptMemo inputs;
+  };
+  unordered_map<const Card*, CardKey> keys;
+  intrusive_ptr<OrderCache<CardP>>    order;
+  bool                                outdated = false; ///< Can the keys have changed since they were determined?
+  bool                                used     = true;  ///< Was the order used since the last invalidateOrderCache?
+};
+
 Set::Set()
   : vcs (make_intrusive<VCS>())
   , script_manager(new SetScriptManager(*this))
@@ -64,6 +78,23 @@ void Set::updateStyles(const CardP& card, bool only_content_dependent) {
 void Set::updateDelayed() {
   script_manager->updateDelayed();
 }
+void Set::updateDelayed(const CardP& card) {
+  script_manager->updateDelayed(card);
+}
+bool Set::updateDelayedStep() {
+  return script_manager->updateDelayedStep();
+}
+KeywordDatabase& Set::keywordDatabase() {
+  lock_guard<mutex> lock(keyword_db_mutex);
+  if (keyword_db.empty()) {
+    keyword_db.prepare_parameters(game->keyword_parameter_types, keywords);
+    keyword_db.prepare_parameters(game->keyword_parameter_types, game->keywords);
+    keyword_db.add(keywords);
+    keyword_db.add(game->keywords);
+    keyword_db.prepare();
+  }
+  return keyword_db;
+}
 
 Context& Set::getContextForThumbnails() {
   assert(!wxThread::IsMain());
@@ -123,6 +154,7 @@ String Set::identification() const {
 
 String Set::typeName() const { return _("set"); }
 Version Set::fileVersion() const { return file_version_set; }
+void Set::beforeSave() { updateDelayed(); }
 
 // fix values for versions < 0.2.7
 void fix_value_207(const ValueP& value) {
@@ -275,45 +307,73 @@ void reflect_set_info_get_member(GetMember& handler, const IndexMap<FieldP, Valu
 }
 
 int Set::positionOfCard(const CardP& card, const ScriptValueP& order_by, const ScriptValueP& filter) {
-  // TODO : Lock the map?
+  lock_guard<recursive_mutex> lock(order_cache_mutex);
   assert(order_by);
-  OrderCacheP& order = order_cache[make_pair(order_by,filter)];
-  if (!order) {
-    // 1. make a list of the order value for each card
+  unique_ptr<CardOrder>& order = order_cache[make_pair(order_by,filter)];
+  if (order) order->used = true;
+  if (!order || order->outdated) {
+    if (!order) order = make_unique<CardOrder>();
+    // 1. make a list of the order value for each card,
+    //    only evaluate the functions for cards where the things they read have changed
+    unordered_map<const Card*, CardOrder::CardKey> keys;
     vector<String> values; values.reserve(cards.size());
     vector<int>    keep;   if(filter) keep.reserve(cards.size());
     FOR_EACH_CONST(c, cards) {
-      Context& ctx = getContext(c);
-      values.push_back(order_by->eval(ctx)->toString());
-      if (filter) {
-        keep.push_back(filter->eval(ctx)->toBool());
+      Context& ctx = script_manager->getContext(c); // not getContext, this can be a worker thread, see order_cache_mutex
+      CardOrder::CardKey& key = keys[c.get()];
+      auto old = order->keys.find(c.get());
+      if (old != order->keys.end() && old->second.inputs.cacheable && ctx.sameInputs(old->second.inputs)) {
+        key = move(old->second);
+      } else {
+        key.value = ctx.evalRecorded(*order_by, key.inputs)->toString();
+        key.keep  = !filter || ctx.evalRecorded(*filter, key.inputs)->toBool();
       }
+      values.push_back(key.value);
+      if (filter) keep.push_back(key.keep);
     }
+    order->keys.swap(keys);
+    order->outdated = false;
     #if USE_SCRIPT_PROFILING
       Timer t;
       Profiler prof(t, order_by.get(), _("init order cache"));
     #endif
-    // 3. initialize order cache
-    order = make_intrusive<OrderCache<CardP>>(cards, values, filter ? &keep : nullptr);
+    // 2. (re)position the cards whose value changed
+    if (order->order) {
+      order->order->update(cards, values, filter ? &keep : nullptr);
+    } else {
+      order->order = make_intrusive<OrderCache<CardP>>(cards, values, filter ? &keep : nullptr);
+    }
   }
-  return order->find(card);
+  return order->order->find(card);
 }
 int Set::numberOfCards(const ScriptValueP& filter) {
   if (!filter) return (int)cards.size();
+  lock_guard<recursive_mutex> lock(order_cache_mutex);
   map<ScriptValueP,int>::const_iterator it = filter_cache.find(filter);
   if (it !=filter_cache.end()) {
     return it->second;
   } else {
     int n = 0;
     FOR_EACH_CONST(c, cards) {
-      if (filter->eval(getContext(c))->toBool()) ++n;
+      if (filter->eval(script_manager->getContext(c))->toBool()) ++n;
     }
     filter_cache.insert(make_pair(filter,n));
     return n;
   }
 }
-void Set::clearOrderCache() {
-  order_cache.clear();
+void Set::invalidateOrderCache() {
+  lock_guard<recursive_mutex> lock(order_cache_mutex);
+  // orders that were not used since the previous time are dropped,
+  // otherwise functions that are created anew for each evaluation would fill up the cache
+  for (auto it = order_cache.begin() ; it != order_cache.end() ; ) {
+    if (it->second->used) {
+      it->second->outdated = true;
+      it->second->used     = false;
+      ++it;
+    } else {
+      it = order_cache.erase(it);
+    }
+  }
   filter_cache.clear();
 }
 
@@ -14,6 +14,7 @@
 #include <util/io/package.hpp>
 #include <data/field.hpp> // for Set::value
 #include <data/keyword.hpp>
+#include <mutex>
 
 DECLARE_POINTER_TYPE(Card);
 DECLARE_POINTER_TYPE(Set);
@@ -29,8 +30,6 @@ class SetScriptManager;
 class SetScriptContext;
 class Context;
 class Dependency;
-template <typename> class OrderCache;
-typedef intrusive_ptr<OrderCache<CardP>> OrderCacheP;
 
 // ----------------------------------------------------------------------------- : Set
 
@@ -70,7 +69,17 @@ public:
   /// Update styles and extra_card_fields for a card
   void updateStyles(const CardP& card, bool only_content_dependent);
   /// Update scripts that were delayed
+  /** Card values that depend on an edit are only updated when they are needed,
+   *  this should be called before using the values of all cards.
+   */
   void updateDelayed();
+  /// Update scripts of a single card that were delayed, before showing that card
+  void updateDelayed(const CardP& card);
+  /// Update some of the scripts that were delayed, returns true if there is more to do
+  bool updateDelayedStep();
+  /// The keyword database, filled with the keywords of the set and the game if it was cleared
+  /** Can be used from multiple threads at once */
+  KeywordDatabase& keywordDatabase();
   /// A context for performing scripts
   /** Should only be used from the thumbnail thread! */
   Context& getContextForThumbnails();
@@ -111,13 +120,15 @@ public:
   int positionOfCard(const CardP& card, const ScriptValueP& order_by, const ScriptValueP& filter);
   /// Find the number of cards that match the given filter
   int numberOfCards(const ScriptValueP& filter);
-  /// Clear the order_cache used by positionOfCard
-  void clearOrderCache();
+  /// The values of cards may have changed, the order_cache used by positionOfCard has to be checked before it is used again
+  void invalidateOrderCache();
   
   String typeName() const override;
   Version fileVersion() const override;
   /// Validate that the set is correctly loaded
   void validate(Version = app_version) override;
+  /// Values that were delayed are written as well
+  void beforeSave() override;
   
 protected:
   VCSP getVCS() override {
@@ -134,8 +145,14 @@ private:
   /// Object for executing scripts from the thumbnail thread
   unique_ptr<SetScriptContext> thumbnail_script_context;
   /// Cache of cards ordered by some criterion
-  map<pair<ScriptValueP,ScriptValueP>,OrderCacheP> order_cache;
-  map<ScriptValueP,int>                            filter_cache;
+  struct CardOrder;
+  map<pair<ScriptValueP,ScriptValueP>,unique_ptr<CardOrder>> order_cache;
+  map<ScriptValueP,int>                                      filter_cache;
+  /// Protects order_cache and filter_cache, card scripts are evaluated on multiple threads by SetScriptManager::updateAllCards
+  /** Recursive, because order_by and filter functions can use position_of themselves */
+  recursive_mutex order_cache_mutex;
+  /// Protects the lazy filling of keyword_db
+  mutex keyword_db_mutex;
 };
 
 inline String type_name(const Set&) {
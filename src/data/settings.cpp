@@ -171,6 +171,8 @@ Settings::Settings()
   , symbol_grid_size     (30)
   , symbol_grid          (true)
   , symbol_grid_snap     (false)
+  , image_cache_size     (64)
+  , generated_image_cache_size(64)
   , print_layout         (LAYOUT_NO_SPACE)
   #if USE_OLD_STYLE_UPDATE_CHECKER
   , updates_url          (_("http://magicseteditor.sourceforge.net/updates"))
@@ -255,6 +257,8 @@ IMPLEMENT_REFLECTION_NO_SCRIPT(Settings) {
   REFLECT(symbol_grid_size);
   REFLECT(symbol_grid);
   REFLECT(symbol_grid_snap);
+  REFLECT(image_cache_size);
+  REFLECT(generated_image_cache_size);
   REFLECT(default_game);
   REFLECT(print_layout);
   REFLECT(apprentice_location);
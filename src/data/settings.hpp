@@ -159,6 +159,10 @@ public:
   bool symbol_grid;
   bool symbol_grid_snap;
   
+  // --------------------------------------------------- : Caches
+  UInt image_cache_size;           ///< Memory to use for keeping images from packages decoded, in megabytes
+  UInt generated_image_cache_size; ///< Memory to use for remembering generated images, in megabytes
+  
   // --------------------------------------------------- : Default pacakge selections
   String default_game;
   
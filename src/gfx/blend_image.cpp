@@ -42,20 +42,23 @@ void linear_blend(Image& img1, const Image& img2, double x1,double y1, double x2
   int ym = to_int( (y2 - y1) * height * a );
   int d  = to_int( - (x1 * width * xm + y1 * height * ym) );
   
-  Byte *data1 = img1.GetData(), *data2 = img2.GetData();
+  Byte *data1_start = img1.GetData(), *data2_start = img2.GetData();
   // blend pixels
-  for (int y = 0 ; y < height ; ++y) {
-    for (int x = 0 ; x < width ; ++x) {
-      int mult = x * xm + y * ym + d;
-      if (mult < 0)      mult = 0;
-      if (mult > fixed)  mult = fixed;
-      data1[0] = data1[0] + mult * (data2[0] - data1[0]) / fixed;
-      data1[1] = data1[1] + mult * (data2[1] - data1[1]) / fixed;
-      data1[2] = data1[2] + mult * (data2[2] - data1[2]) / fixed;
-      data1 += 3;
-      data2 += 3;
+  parallel_rows(height, 3 * width, [=](int begin, int end) {
+    Byte *data1 = data1_start + 3 * width * begin, *data2 = data2_start + 3 * width * begin;
+    for (int y = begin ; y < end ; ++y) {
+      for (int x = 0 ; x < width ; ++x) {
+        int mult = x * xm + y * ym + d;
+        if (mult < 0)      mult = 0;
+        if (mult > fixed)  mult = fixed;
+        data1[0] = data1[0] + mult * (data2[0] - data1[0]) / fixed;
+        data1[1] = data1[1] + mult * (data2[1] - data1[1]) / fixed;
+        data1[2] = data1[2] + mult * (data2[2] - data1[2]) / fixed;
+        data1 += 3;
+        data2 += 3;
+      }
     }
-  }
+  });
 }
 
 // ----------------------------------------------------------------------------- : Mask Blend
@@ -66,12 +69,14 @@ void mask_blend(Image& img1, const Image& img2, const Image& mask) {
     throw Error(_("Images used for blending must have the same size"));
   }
   
-  UInt size = img1.GetWidth() * img1.GetHeight() * 3;
+  UInt line = img1.GetWidth() * 3;
   Byte *data1 = img1.GetData(), *data2 = img2.GetData(), *dataM = mask.GetData();
   // for each subpixel...
-  for (UInt i = 0 ; i < size ; ++i) {
-    data1[i] = (data1[i] * dataM[i] + data2[i] * (255 - dataM[i])) / 255;
-  }
+  parallel_rows(img1.GetHeight(), line, [=](int begin, int end) {
+    for (UInt i = begin * line ; i < end * line ; ++i) {
+      data1[i] = (data1[i] * dataM[i] + data2[i] * (255 - dataM[i])) / 255;
+    }
+  });
 }
 
 // ----------------------------------------------------------------------------- : Alpha
@@ -80,10 +85,12 @@ void set_alpha(Image& img, const Image& img_alpha) {
   Image img_alpha_resampled = resample(img_alpha, img.GetWidth(), img.GetHeight());
   if (!img.HasAlpha()) img.InitAlpha();
   Byte *im = img.GetAlpha(), *al = img_alpha_resampled.GetData();
-  size_t size = img.GetWidth() * img.GetHeight();
-  for (size_t i = 0 ; i < size ; ++i) {
-    im[i] = (im[i] * al[i*3]) / 255;
-  }
+  size_t line = img.GetWidth();
+  parallel_rows(img.GetHeight(), line, [=](int begin, int end) {
+    for (size_t i = begin * line ; i < end * line ; ++i) {
+      im[i] = (im[i] * al[i*3]) / 255;
+    }
+  });
 }
 
 void set_alpha(Image& img, Byte* al, const wxSize& alpha_size) {
@@ -97,10 +104,12 @@ void set_alpha(Image& img, Byte* al, const wxSize& alpha_size) {
   } else{
     // merge
     Byte *im = img.GetAlpha();
-    size_t size = img.GetWidth() * img.GetHeight();
-    for (size_t i = 0 ; i < size ; ++i) {
-      im[i] = (im[i] * al[i]) / 255;
-    }
+    size_t line = img.GetWidth();
+    parallel_rows(img.GetHeight(), line, [=](int begin, int end) {
+      for (size_t i = begin * line ; i < end * line ; ++i) {
+        im[i] = (im[i] * al[i]) / 255;
+      }
+    });
   }
 }
 
@@ -111,9 +120,11 @@ void set_alpha(Image& img, double alpha) {
     memset(img.GetAlpha(), b_alpha, img.GetWidth() * img.GetHeight());
   } else {
     Byte *im = img.GetAlpha();
-    size_t size = img.GetWidth() * img.GetHeight();
-    for (size_t i = 0 ; i < size ; ++i) {
-      im[i] = (im[i] * b_alpha) / 255;
-    }
+    size_t line = img.GetWidth();
+    parallel_rows(img.GetHeight(), line, [=](int begin, int end) {
+      for (size_t i = begin * line ; i < end * line ; ++i) {
+        im[i] = (im[i] * b_alpha) / 255;
+      }
+    });
   }
 }
@@ -89,14 +89,45 @@ COMBINE_FUN(COMBINE_SYMMETRIC_OVERLAY, (Combine<COMBINE_OVERLAY>::f(a,b) + Combi
 
 /// Combine image b onto image a using some combining mode.
 /// The results are stored in the image A.
+/** For the simple modes the compiler turns this loop into vector instructions */
 template <ImageCombine combine>
 void combine_image_do(Image& a, Image b) {
-  UInt size = a.GetWidth() * a.GetHeight() * 3;
+  UInt line = a.GetWidth() * 3;
   Byte *dataA = a.GetData(), *dataB = b.GetData();
   // for each pixel: apply function
-  for (UInt i = 0 ; i < size ; ++i) {
-    dataA[i] = Combine<combine>::f(dataA[i], dataB[i]);
+  parallel_rows(a.GetHeight(), line, [=](int begin, int end) {
+    for (UInt i = begin * line ; i < end * line ; ++i) {
+      dataA[i] = Combine<combine>::f(dataA[i], dataB[i]);
+    }
+  });
+}
+
+/// The result of a combining function for all pairs of bytes
+template <ImageCombine combine> struct CombineTable {
+  CombineTable() {
+    for (int a = 0 ; a < 256 ; ++a) {
+      for (int b = 0 ; b < 256 ; ++b) {
+        table[a][b] = (Byte)Combine<combine>::f(a, b);
+      }
+    }
   }
+  Byte table[256][256];
+};
+
+/// Combine image b onto image a, by looking up the result in a table.
+/** Used for the modes that divide by one of the bytes, the table gives exactly the same results.
+ *  Modes that only divide by a constant are compiled to multiplications, those are not faster with a table.
+ */
+template <ImageCombine combine>
+void combine_image_table(Image& a, Image b) {
+  static const CombineTable<combine> combined;
+  UInt line = a.GetWidth() * 3;
+  Byte *dataA = a.GetData(), *dataB = b.GetData();
+  parallel_rows(a.GetHeight(), line, [=](int begin, int end) {
+    for (UInt i = begin * line ; i < end * line ; ++i) {
+      dataA[i] = combined.table[dataA[i]][dataB[i]];
+    }
+  });
 }
 
 void combine_image(Image& a, const Image& b, ImageCombine combine) {
@@ -111,6 +142,7 @@ void combine_image(Image& a, const Image& b, ImageCombine combine) {
   // Combine image data, by dispatching to combineImageDo
   switch(combine) {
     #define DISPATCH(comb) case comb: combine_image_do<comb>(a,b); return
+    #define DISPATCH_TABLE(comb) case comb: combine_image_table<comb>(a,b); return
     case COMBINE_DEFAULT:
     case COMBINE_NORMAL: a = b; return; // no need to do a per pixel operation
     DISPATCH(COMBINE_ADD);
@@ -121,16 +153,16 @@ void combine_image(Image& a, const Image& b, ImageCombine combine) {
     DISPATCH(COMBINE_MULTIPLY);
     DISPATCH(COMBINE_DARKEN);
     DISPATCH(COMBINE_LIGHTEN);
-    DISPATCH(COMBINE_COLOR_DODGE);
-    DISPATCH(COMBINE_COLOR_BURN);
+    DISPATCH_TABLE(COMBINE_COLOR_DODGE);
+    DISPATCH_TABLE(COMBINE_COLOR_BURN);
     DISPATCH(COMBINE_SCREEN);
     DISPATCH(COMBINE_OVERLAY);
     DISPATCH(COMBINE_HARD_LIGHT);
     DISPATCH(COMBINE_SOFT_LIGHT);
-    DISPATCH(COMBINE_REFLECT);
-    DISPATCH(COMBINE_GLOW);
-    DISPATCH(COMBINE_FREEZE);
-    DISPATCH(COMBINE_HEAT);
+    DISPATCH_TABLE(COMBINE_REFLECT);
+    DISPATCH_TABLE(COMBINE_GLOW);
+    DISPATCH_TABLE(COMBINE_FREEZE);
+    DISPATCH_TABLE(COMBINE_HEAT);
     DISPATCH(COMBINE_AND);
     DISPATCH(COMBINE_OR);
     DISPATCH(COMBINE_XOR);
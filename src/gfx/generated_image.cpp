@@ -14,6 +14,10 @@
 #include <data/field/symbol.hpp>
 #include <render/symbol/filter.hpp>
 #include <gui/util.hpp> // load_resource_image
+#include <data/settings.hpp>
+#include <list>
+#include <mutex>
+#include <typeinfo>
 
 // ----------------------------------------------------------------------------- : GeneratedImage
 
@@ -24,7 +28,131 @@ GeneratedImageP GeneratedImage::toImage() const {
 }
 
 Image GeneratedImage::generateConform(const Options& options) const {
-  return conform_image(generate(options),options);
+  return conform_image(generateCached(options),options);
+}
+
+size_t GeneratedImage::hash() const {
+  return typeid(*this).hash_code();
+}
+
+inline size_t hash_combine(size_t seed, size_t value) {
+  return seed ^ (value + 0x9e3779b9 + (seed << 6) + (seed >> 2));
+}
+
+// ----------------------------------------------------------------------------- : GeneratedImageCache
+
+/// Cache of generated images, shared by all cards, viewers and exports.
+/** The same frame blends are used by many cards; this way they are generated once for each size.
+ *  Images are looked up by structure, using GeneratedImage::hash and operator ==.
+ *  Only the options used by generate() are part of the key, zoom, angle and saturation are applied afterwards by conform_image.
+ *  The least recently used images are evicted when more than settings.generated_image_cache_size megabytes are used.
+ */
+class GeneratedImageCache {
+public:
+  Image get(const GeneratedImage& image, const GeneratedImage::Options& opt);
+  ImageCacheStats stats();
+private:
+  struct Key {
+    GeneratedImageP image;
+    int             width, height;
+    PreserveAspect  preserve_aspect;
+    String          package, local_package; ///< Absolute filenames of the packages
+    wxDateTime      package_modified, local_package_modified; ///< Images from a package that was reloaded are different
+    size_t          hash;
+    
+    bool operator == (const Key& that) const {
+      return width == that.width && height == that.height && preserve_aspect == that.preserve_aspect
+          && package == that.package && local_package == that.local_package
+          && package_modified == that.package_modified && local_package_modified == that.local_package_modified
+          && *image == *that.image;
+    }
+  };
+  struct Entry {
+    Key    key;
+    Image  image;
+    size_t bytes;
+  };
+  typedef list<Entry> Entries;
+  Entries                                         entries; ///< Most recently used first
+  unordered_multimap<size_t, Entries::iterator>   index;   ///< Entries by hash of the key
+  size_t                                          bytes = 0;
+  size_t                                          hits = 0, misses = 0;
+  mutex                                           lock;
+  
+  Entries::iterator find(const Key& key);
+  void erase(Entries::iterator it);
+};
+
+GeneratedImageCache::Entries::iterator GeneratedImageCache::find(const Key& key) {
+  auto range = index.equal_range(key.hash);
+  for (auto it = range.first ; it != range.second ; ++it) {
+    if (it->second->key == key) return it->second;
+  }
+  return entries.end();
+}
+
+void GeneratedImageCache::erase(Entries::iterator it) {
+  auto range = index.equal_range(it->key.hash);
+  for (auto i = range.first ; i != range.second ; ++i) {
+    if (i->second == it) {
+      index.erase(i);
+      break;
+    }
+  }
+  bytes -= it->bytes;
+  entries.erase(it);
+}
+
+Image GeneratedImageCache::get(const GeneratedImage& image, const GeneratedImage::Options& opt) {
+  Key key = {image.toImage(), opt.width, opt.height, opt.preserve_aspect,
+             opt.package ? opt.package->absoluteFilename() : String(),
+             opt.local_package ? opt.local_package->absoluteFilename() : String(),
+             opt.package ? opt.package->lastModified() : wxDateTime(),
+             opt.local_package ? opt.local_package->lastModified() : wxDateTime(),
+             0};
+  key.hash = hash_combine(hash_combine(hash_combine(image.hash(), opt.width), opt.height), std::hash<String>()(key.package));
+  {
+    lock_guard<mutex> guard(lock);
+    auto it = find(key);
+    if (it != entries.end()) {
+      hits++;
+      entries.splice(entries.begin(), entries, it);
+      // callers are free to modify the pixels, so they get a copy
+      return it->image.Copy();
+    }
+    misses++;
+  }
+  // generate without holding the lock
+  Image img = image.generate(opt);
+  size_t img_bytes = (size_t)img.GetWidth() * img.GetHeight() * (img.HasAlpha() ? 4 : 3);
+  size_t max_bytes = (size_t)settings.generated_image_cache_size * 1024 * 1024;
+  if (img_bytes > max_bytes) return img;
+  lock_guard<mutex> guard(lock);
+  auto it = find(key);
+  if (it != entries.end()) erase(it); // another thread was first
+  entries.push_front(Entry{key, img.Copy(), img_bytes});
+  index.emplace(key.hash, entries.begin());
+  bytes += img_bytes;
+  while (bytes > max_bytes) {
+    erase(prev(entries.end()));
+  }
+  return img;
+}
+
+ImageCacheStats GeneratedImageCache::stats() {
+  lock_guard<mutex> guard(lock);
+  return ImageCacheStats{hits, misses, entries.size(), bytes};
+}
+
+GeneratedImageCache generated_image_cache;
+
+ImageCacheStats generated_image_cache_stats() {
+  return generated_image_cache.stats();
+}
+
+Image GeneratedImage::generateCached(const Options& opt) const {
+  if (!cacheable()) return generate(opt);
+  return generated_image_cache.get(*this, opt);
 }
 
 Image conform_image(const Image& img, const GeneratedImage::Options& options) {
@@ -78,6 +206,12 @@ Image conform_image(const Image& img, const GeneratedImage::Options& options) {
   return image;
 }
 
+// ----------------------------------------------------------------------------- : SimpleFilterImage
+
+size_t SimpleFilterImage::hash() const {
+  return hash_combine(GeneratedImage::hash(), image->hash());
+}
+
 // ----------------------------------------------------------------------------- : BlankImage
 
 Image BlankImage::generate(const Options& opt) const {
@@ -97,8 +231,8 @@ bool BlankImage::operator == (const GeneratedImage& that) const {
 // ----------------------------------------------------------------------------- : LinearBlendImage
 
 Image LinearBlendImage::generate(const Options& opt) const {
-  Image img = image1->generate(opt);
-  linear_blend(img, image2->generate(opt), x1, y1, x2, y2);
+  Image img = image1->generateCached(opt);
+  linear_blend(img, image2->generateCached(opt), x1, y1, x2, y2);
   return img;
 }
 ImageCombine LinearBlendImage::combine() const {
@@ -111,12 +245,15 @@ bool LinearBlendImage::operator == (const GeneratedImage& that) const {
                && x1 == that2->x1 && y1 == that2->y1
                && x2 == that2->x2 && y2 == that2->y2;
 }
+size_t LinearBlendImage::hash() const {
+  return hash_combine(hash_combine(GeneratedImage::hash(), image1->hash()), image2->hash());
+}
 
 // ----------------------------------------------------------------------------- : MaskedBlendImage
 
 Image MaskedBlendImage::generate(const Options& opt) const {
-  Image img = light->generate(opt);
-  mask_blend(img, dark->generate(opt), mask->generate(opt));
+  Image img = light->generateCached(opt);
+  mask_blend(img, dark->generateCached(opt), mask->generateCached(opt));
   return img;
 }
 ImageCombine MaskedBlendImage::combine() const {
@@ -128,12 +265,15 @@ bool MaskedBlendImage::operator == (const GeneratedImage& that) const {
                && *dark  == *that2->dark
                && *mask  == *that2->mask;
 }
+size_t MaskedBlendImage::hash() const {
+  return hash_combine(hash_combine(hash_combine(GeneratedImage::hash(), light->hash()), dark->hash()), mask->hash());
+}
 
 // ----------------------------------------------------------------------------- : CombineBlendImage
 
 Image CombineBlendImage::generate(const Options& opt) const {
-  Image img = image1->generate(opt);
-  combine_image(img, image2->generate(opt), image_combine);
+  Image img = image1->generateCached(opt);
+  combine_image(img, image2->generateCached(opt), image_combine);
   return img;
 }
 ImageCombine CombineBlendImage::combine() const {
@@ -145,12 +285,15 @@ bool CombineBlendImage::operator == (const GeneratedImage& that) const {
                && *image2 == *that2->image2
                && image_combine == that2->image_combine;
 }
+size_t CombineBlendImage::hash() const {
+  return hash_combine(hash_combine(hash_combine(GeneratedImage::hash(), image1->hash()), image2->hash()), image_combine);
+}
 
 // ----------------------------------------------------------------------------- : SetMaskImage
 
 Image SetMaskImage::generate(const Options& opt) const {
-  Image img = image->generate(opt);
-  set_alpha(img, mask->generate(opt));
+  Image img = image->generateCached(opt);
+  set_alpha(img, mask->generateCached(opt));
   return img;
 }
 bool SetMaskImage::operator == (const GeneratedImage& that) const {
@@ -158,9 +301,12 @@ bool SetMaskImage::operator == (const GeneratedImage& that) const {
   return that2 && *image == *that2->image
                && *mask  == *that2->mask;
 }
+size_t SetMaskImage::hash() const {
+  return hash_combine(SimpleFilterImage::hash(), mask->hash());
+}
 
 Image SetAlphaImage::generate(const Options& opt) const {
-  Image img = image->generate(opt);
+  Image img = image->generateCached(opt);
   set_alpha(img, alpha);
   return img;
 }
@@ -173,7 +319,7 @@ bool SetAlphaImage::operator == (const GeneratedImage& that) const {
 // ----------------------------------------------------------------------------- : SetCombineImage
 
 Image SetCombineImage::generate(const Options& opt) const {
-  return image->generate(opt);
+  return image->generateCached(opt);
 }
 ImageCombine SetCombineImage::combine() const {
   return image_combine;
@@ -187,7 +333,7 @@ bool SetCombineImage::operator == (const GeneratedImage& that) const {
 // ----------------------------------------------------------------------------- : SaturateImage
 
 Image SaturateImage::generate(const Options& opt) const {
-  Image img = image->generate(opt);
+  Image img = image->generateCached(opt);
   saturate(img, amount);
   return img;
 }
@@ -200,7 +346,7 @@ bool SaturateImage::operator == (const GeneratedImage& that) const {
 // ----------------------------------------------------------------------------- : InvertImage
 
 Image InvertImage::generate(const Options& opt) const {
-  Image img = image->generate(opt);
+  Image img = image->generateCached(opt);
   invert(img);
   return img;
 }
@@ -212,7 +358,7 @@ bool InvertImage::operator == (const GeneratedImage& that) const {
 // ----------------------------------------------------------------------------- : RecolorImage
 
 Image RecolorImage::generate(const Options& opt) const {
-  Image img = image->generate(opt);
+  Image img = image->generateCached(opt);
   recolor(img, color);
   return img;
 }
@@ -223,7 +369,7 @@ bool RecolorImage::operator == (const GeneratedImage& that) const {
 }
 
 Image RecolorImage2::generate(const Options& opt) const {
-  Image img = image->generate(opt);
+  Image img = image->generateCached(opt);
   recolor(img, red,green,blue,white);
   return img;
 }
@@ -239,7 +385,7 @@ bool RecolorImage2::operator == (const GeneratedImage& that) const {
 // ----------------------------------------------------------------------------- : FlipImage
 
 Image FlipImageHorizontal::generate(const Options& opt) const {
-  Image img = image->generate(opt);
+  Image img = image->generateCached(opt);
   return flip_image_horizontal(img);
 }
 bool FlipImageHorizontal::operator == (const GeneratedImage& that) const {
@@ -248,7 +394,7 @@ bool FlipImageHorizontal::operator == (const GeneratedImage& that) const {
 }
 
 Image FlipImageVertical::generate(const Options& opt) const {
-  Image img = image->generate(opt);
+  Image img = image->generateCached(opt);
   return flip_image_vertical(img);
 }
 bool FlipImageVertical::operator == (const GeneratedImage& that) const {
@@ -257,7 +403,7 @@ bool FlipImageVertical::operator == (const GeneratedImage& that) const {
 }
 
 Image RotateImage::generate(const Options& opt) const {
-  Image img = image->generate(opt);
+  Image img = image->generateCached(opt);
   return rotate_image(img,angle);
 }
 bool RotateImage::operator == (const GeneratedImage& that) const {
@@ -276,7 +422,7 @@ Image EnlargeImage::generate(const Options& opt) const {
     , opt.package
     , opt.local_package
     , opt.preserve_aspect);
-  Image img = image->generate(sub_opt);
+  Image img = image->generateCached(sub_opt);
   // size of generated image
   int w  = img.GetWidth(),  h = img.GetHeight();  // original image size
   int dw = int(w * border_size), dh = int(h * border_size); // delta
@@ -307,7 +453,7 @@ bool EnlargeImage::operator == (const GeneratedImage& that) const {
 // ----------------------------------------------------------------------------- : CropImage
 
 Image CropImage::generate(const Options& opt) const {
-  return image->generate(opt).Size(wxSize((int)width, (int)height), wxPoint(-(int)offset_x, -(int)offset_y));
+  return image->generateCached(opt).Size(wxSize((int)width, (int)height), wxPoint(-(int)offset_x, -(int)offset_y));
 }
 bool CropImage::operator == (const GeneratedImage& that) const {
   const CropImage* that2 = dynamic_cast<const CropImage*>(&that);
@@ -330,18 +476,27 @@ UInt gaussian_blur(Byte* in, UInt* out, int w, int h, double radius) {
     double mult = (1 << 8) / (sqrt(2 * M_PI) * sigma);
     double sigsqr2 = 1 / (2 * sigma * sigma);
     int range = min(w, (int)(3*sigma));
+    vector<UInt> factors;
     for (int d = -range ; d <= range ; ++d) {
       UInt factor = (int)( mult * exp(-d * d * sigsqr2) );
       total_x += factor;
-      if (factor > 0) {
-        int x_start = max(0, -d), x_end = min(w, w-d);
-        for (int y = 0 ; y < h ; ++y) {
-          for (int x = x_start ; x < x_end ; ++x) {
-            blur_x[x + y*w] += in[x + d + y*w] * factor;
+      factors.push_back(factor);
+    }
+    // each row is blurred independently
+    UInt* blur = blur_x.get();
+    parallel_rows(h, w * sizeof(UInt), [&](int begin, int end) {
+      for (int d = -range ; d <= range ; ++d) {
+        UInt factor = factors[d + range];
+        if (factor > 0) {
+          int x_start = max(0, -d), x_end = min(w, w-d);
+          for (int y = begin ; y < end ; ++y) {
+            for (int x = x_start ; x < x_end ; ++x) {
+              blur[x + y*w] += in[x + d + y*w] * factor;
+            }
           }
         }
       }
-    }
+    });
   }
   // blur vertically
   memset(out, 0, w*h*sizeof(UInt));
@@ -351,25 +506,34 @@ UInt gaussian_blur(Byte* in, UInt* out, int w, int h, double radius) {
     double mult = (1 << 8) / (sqrt(2 * M_PI) * sigma);
     double sigsqr2 = 1 / (2 * sigma * sigma);
     int range = min(h, (int)(3*sigma));
+    vector<UInt> factors;
     for (int d = -range ; d <= range ; ++d) {
       UInt factor = (UInt)( mult * exp(-d * d * sigsqr2) );
       total_y += factor;
-      if (factor > 0) {
-        int y_start = max(0, -d), y_end = min(h, h-d);
-        for (int y = y_start ; y < y_end ; ++y) {
-          for (int x = 0 ; x < w ; ++x) {
-            out[x + y*w] += blur_x[x + (d + y)*w] * factor;
+      factors.push_back(factor);
+    }
+    // each output row only depends on blur_x, so rows can be done in parallel
+    const UInt* blur = blur_x.get();
+    parallel_rows(h, w * sizeof(UInt), [&](int begin, int end) {
+      for (int d = -range ; d <= range ; ++d) {
+        UInt factor = factors[d + range];
+        if (factor > 0) {
+          int y_start = max(begin, -d), y_end = min(end, h-d);
+          for (int y = y_start ; y < y_end ; ++y) {
+            for (int x = 0 ; x < w ; ++x) {
+              out[x + y*w] += blur[x + (d + y)*w] * factor;
+            }
           }
         }
       }
-    }
+    });
   }
   return total_x * total_y;
 }
 
 Image DropShadowImage::generate(const Options& opt) const {
   // sub image
-  Image img = image->generate(opt);
+  Image img = image->generateCached(opt);
   if (!img.HasAlpha()) {
     // no alpha, there is nothing we can do
     return img;
@@ -386,18 +550,22 @@ Image DropShadowImage::generate(const Options& opt) const {
   int x_end   = min(w, w+dw), y_end   = min(h, h+dh);
   int delta = dw + w * dh;
   int sa = (int)(shadow_alpha * (1 << 16));
-  for (int y = y_start ; y < y_end ; ++y) {
-    for (int x = x_start ; x < x_end ; ++x) {
-      int p  = x + y * w; // pixel we are working on
-      int a = alpha[p];
-      int shad = ((((255 - a)*sa)>>16) * shadow[p - delta]) / total; // amount of shadow to add
-      int factor = max(1, a + shad); // divide by this
-      data[3 * p    ] = (a * data[3 * p    ] + shad * shadow_color.Red()  ) / factor;
-      data[3 * p + 1] = (a * data[3 * p + 1] + shad * shadow_color.Green()) / factor;
-      data[3 * p + 2] = (a * data[3 * p + 2] + shad * shadow_color.Blue() ) / factor;
-      alpha[p] = a + shad;
+  int shadow_r = shadow_color.Red(), shadow_g = shadow_color.Green(), shadow_b = shadow_color.Blue();
+  const UInt* shadow_data = shadow.get();
+  parallel_rows(max(0, y_end - y_start), 3 * w, [&](int begin, int end) {
+    for (int y = y_start + begin ; y < y_start + end ; ++y) {
+      for (int x = x_start ; x < x_end ; ++x) {
+        int p  = x + y * w; // pixel we are working on
+        int a = alpha[p];
+        int shad = ((((255 - a)*sa)>>16) * shadow_data[p - delta]) / total; // amount of shadow to add
+        int factor = max(1, a + shad); // divide by this
+        data[3 * p    ] = (a * data[3 * p    ] + shad * shadow_r) / factor;
+        data[3 * p + 1] = (a * data[3 * p + 1] + shad * shadow_g) / factor;
+        data[3 * p + 2] = (a * data[3 * p + 2] + shad * shadow_b) / factor;
+        alpha[p] = a + shad;
+      }
     }
-  }
+  });
   return img;
 }
 bool DropShadowImage::operator == (const GeneratedImage& that) const {
@@ -410,23 +578,96 @@ bool DropShadowImage::operator == (const GeneratedImage& that) const {
 
 // ----------------------------------------------------------------------------- : PackagedImage
 
+/// Cache of decoded images from packages.
+/** The same frame and border images are used for every card, this way they are only read and decoded once.
+ *  The least recently used images are evicted when more than settings.image_cache_size megabytes are used.
+ */
+class PackagedImageCache {
+public:
+  /// Load an image from a package, or get it from the cache
+  Image get(Package& package, const String& filename);
+  ImageCacheStats stats();
+private:
+  struct Entry {
+    pair<String,String> key; ///< Package and file name
+    wxDateTime          modified; ///< Modification time of the package when the image was loaded
+    Image               image;
+    size_t              bytes;
+  };
+  typedef list<Entry> Entries;
+  Entries                                 entries; ///< Most recently used first
+  map<pair<String,String>, Entries::iterator> index;
+  size_t                                  bytes = 0;
+  size_t                                  hits = 0, misses = 0;
+  mutex                                   lock;
+};
+
+Image PackagedImageCache::get(Package& package, const String& filename) {
+  pair<String,String> key(package.absoluteFilename(), filename);
+  {
+    lock_guard<mutex> guard(lock);
+    auto it = index.find(key);
+    if (it != index.end() && it->second->modified == package.lastModified()) {
+      hits++;
+      entries.splice(entries.begin(), entries, it->second);
+      // callers are free to modify the pixels, so they get a copy
+      return it->second->image.Copy();
+    }
+    misses++;
+  }
+  // load without holding the lock
+  auto file_stream = package.openIn(filename);
+  Image img;
+  if (!image_load_file(img, *file_stream)) {
+    throw ScriptError(_("Unable to load image '") + filename + _("' from '" + package.name() + _("'")));
+  }
+  if (img.HasMask()) img.InitAlpha(); // we can't handle masks
+  size_t img_bytes = (size_t)img.GetWidth() * img.GetHeight() * (img.HasAlpha() ? 4 : 3);
+  size_t max_bytes = (size_t)settings.image_cache_size * 1024 * 1024;
+  if (img_bytes > max_bytes) return img;
+  lock_guard<mutex> guard(lock);
+  auto it = index.find(key);
+  if (it != index.end()) {
+    // an outdated entry, or another thread was first
+    bytes -= it->second->bytes;
+    entries.erase(it->second);
+    index.erase(it);
+  }
+  entries.push_front(Entry{key, package.lastModified(), img.Copy(), img_bytes});
+  index.emplace(key, entries.begin());
+  bytes += img_bytes;
+  while (bytes > max_bytes) {
+    bytes -= entries.back().bytes;
+    index.erase(entries.back().key);
+    entries.pop_back();
+  }
+  return img;
+}
+
+ImageCacheStats PackagedImageCache::stats() {
+  lock_guard<mutex> guard(lock);
+  return ImageCacheStats{hits, misses, entries.size(), bytes};
+}
+
+PackagedImageCache packaged_image_cache;
+
+ImageCacheStats packaged_image_cache_stats() {
+  return packaged_image_cache.stats();
+}
+
 Image PackagedImage::generate(const Options& opt) const {
   // TODO : use opt.width and opt.height?
   // open file from package
   if (!opt.package) throw ScriptError(_("Can only load images in a context where an image is expected"));
-  auto file_stream = opt.package->openIn(filename);
-  Image img;
-  if (image_load_file(img, *file_stream)) {
-    if (img.HasMask()) img.InitAlpha(); // we can't handle masks
-    return img;
-  } else {
-    throw ScriptError(_("Unable to load image '") + filename + _("' from '" + opt.package->name() + _("'")));
-  }
+  return packaged_image_cache.get(*opt.package, filename);
 }
 bool PackagedImage::operator == (const GeneratedImage& that) const {
   const PackagedImage* that2 = dynamic_cast<const PackagedImage*>(&that);
   return that2 && filename == that2->filename;
 }
+size_t PackagedImage::hash() const {
+  return hash_combine(GeneratedImage::hash(), std::hash<String>()(filename));
+}
 
 // ----------------------------------------------------------------------------- : BuiltInImage
 
@@ -442,6 +683,9 @@ bool BuiltInImage::operator == (const GeneratedImage& that) const {
   const BuiltInImage* that2 = dynamic_cast<const BuiltInImage*>(&that);
   return that2 && name == that2->name;
 }
+size_t BuiltInImage::hash() const {
+  return hash_combine(GeneratedImage::hash(), std::hash<String>()(name));
+}
 
 // ----------------------------------------------------------------------------- : SymbolToImage
 
@@ -478,6 +722,9 @@ bool SymbolToImage::operator == (const GeneratedImage& that) const {
                    *variation == *that2->variation // custom variation
                   );
 }
+size_t SymbolToImage::hash() const {
+  return hash_combine(hash_combine(GeneratedImage::hash(), std::hash<String>()(filename.toStringForKey())), (size_t)age.get());
+}
 
 // ----------------------------------------------------------------------------- : ImageValueToImage
 
@@ -504,3 +751,6 @@ bool ImageValueToImage::operator == (const GeneratedImage& that) const {
   return that2 && filename == that2->filename
                && age      == that2->age;
 }
+size_t ImageValueToImage::hash() const {
+  return hash_combine(hash_combine(GeneratedImage::hash(), std::hash<String>()(filename.toStringForKey())), (size_t)age.get());
+}
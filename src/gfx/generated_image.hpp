@@ -47,11 +47,18 @@ public:
   Image generateConform(const Options&) const;
   /// Generate the image
   virtual Image generate(const Options&) const = 0;
+  /// Generate the image, or reuse the result of generating an equal image with the same options
+  /** Only images that are cacheable() are remembered, other images are generated directly */
+  Image generateCached(const Options&) const;
   /// How must the image be combined with the background?
   virtual ImageCombine combine() const { return COMBINE_DEFAULT; }
   /// Equality should mean that every pixel in the generated images is the same if the same options are used
   virtual bool operator == (const GeneratedImage& that) const = 0;
   inline  bool operator != (const GeneratedImage& that) const { return !(*this == that); }
+  /// Hash of the structure of this image, equal images must have the same hash
+  virtual size_t hash() const;
+  /// Is this image expensive enough to generate that the result should be remembered?
+  virtual bool cacheable() const { return false; }
   
   /// Can this image be generated safely from another thread?
   virtual bool threadSafe() const { return true; }
@@ -68,6 +75,16 @@ public:
 /// Resize an image to conform to the options
 Image conform_image(const Image&, const GeneratedImage::Options&);
 
+/// Usage of an image cache
+struct ImageCacheStats {
+  size_t hits, misses;  ///< Number of lookups that found / didn't find the image
+  size_t images, bytes; ///< Contents of the cache
+};
+/// Usage of the cache of images loaded from packages
+ImageCacheStats packaged_image_cache_stats();
+/// Usage of the cache used by GeneratedImage::generateCached
+ImageCacheStats generated_image_cache_stats();
+
 // ----------------------------------------------------------------------------- : SimpleFilterImage
 
 /// Apply some filter to a single image
@@ -78,6 +95,7 @@ public:
   {}
   ImageCombine combine() const override { return image->combine(); }
   bool local() const override { return image->local(); }
+  size_t hash() const override;
 protected:
   GeneratedImageP image;
 };
@@ -109,6 +127,8 @@ public:
   ImageCombine combine() const override;
   bool operator == (const GeneratedImage& that) const override;
   bool local() const override { return image1->local() && image2->local(); }
+  size_t hash() const override;
+  bool cacheable() const override { return true; }
 private:
   GeneratedImageP image1, image2;
   double x1, y1, x2, y2;
@@ -126,6 +146,8 @@ public:
   ImageCombine combine() const override;
   bool operator == (const GeneratedImage& that) const override;
   bool local() const override { return light->local() && dark->local() && mask->local(); }
+  size_t hash() const override;
+  bool cacheable() const override { return true; }
 private:
   GeneratedImageP light, dark, mask;
 };
@@ -142,6 +164,8 @@ public:
   ImageCombine combine() const override;
   bool operator == (const GeneratedImage& that) const override;
   bool local() const override { return image1->local() && image2->local(); }
+  size_t hash() const override;
+  bool cacheable() const override { return true; }
 private:
   GeneratedImageP image1, image2;
   ImageCombine image_combine;
@@ -157,6 +181,8 @@ public:
   {}
   Image generate(const Options& opt) const override;
   bool operator == (const GeneratedImage& that) const override;
+  size_t hash() const override;
+  bool cacheable() const override { return true; }
 private:
   GeneratedImageP mask;
 };
@@ -313,6 +339,7 @@ public:
   {}
   Image generate(const Options& opt) const override;
   bool operator == (const GeneratedImage& that) const override;
+  bool cacheable() const override { return true; }
 private:
   double offset_x, offset_y;
   double shadow_alpha;
@@ -330,6 +357,7 @@ public:
   {}
   Image generate(const Options& opt) const override;
   bool operator == (const GeneratedImage& that) const override;
+  size_t hash() const override;
 private:
   String filename;
 };
@@ -344,6 +372,7 @@ public:
   {}
   Image generate(const Options& opt) const override;
   bool operator == (const GeneratedImage& that) const override;
+  size_t hash() const override;
 private:
   String name;
 };
@@ -357,6 +386,7 @@ public:
   ~SymbolToImage();
   Image generate(const Options& opt) const override;
   bool operator == (const GeneratedImage& that) const override;
+  size_t hash() const override;
   bool local() const override { return is_local; }
   
   #ifdef __WXGTK__
@@ -379,6 +409,7 @@ public:
   ~ImageValueToImage();
   Image generate(const Options& opt) const override;
   bool operator == (const GeneratedImage& that) const override;
+  size_t hash() const override;
   bool local() const override { return true; }
 private:
   ImageValueToImage(const ImageValueToImage&); // copy ctor
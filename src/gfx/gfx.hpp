@@ -17,6 +17,16 @@
 #include <util/real_point.hpp>
 #include <util/angle.hpp>
 #include <gfx/color.hpp>
+#include <functional>
+
+// ----------------------------------------------------------------------------- : Parallel processing
+
+/// Process the rows [0,rows) of an image in strips, using multiple threads for large images
+/** f(begin,end) is called for disjoint ranges of rows that together cover all rows.
+ *  bytes_per_row is used to decide if the image is large enough to be worth splitting up.
+ *  f may only touch the raw pixel data, not other wx objects.
+ */
+void parallel_rows(int rows, size_t bytes_per_row, const function<void(int begin, int end)>& f);
 
 // ----------------------------------------------------------------------------- : Resampling
 
@@ -0,0 +1,35 @@
+//+----------------------------------------------------------------------------+
+//| Description:  Magic Set Editor - Program to make Magic (tm) cards          |
+//| Copyright:    (C) Twan van Laarhoven and the other MSE developers          |
+//| License:      GNU General Public License 2 or later (see file COPYING)     |
+//+----------------------------------------------------------------------------+
+
+// ----------------------------------------------------------------------------- : Includes
+
+#include <util/prec.hpp>
+#include <gfx/gfx.hpp>
+#include <future>
+#include <thread>
+
+// ----------------------------------------------------------------------------- : Parallel processing
+
+// Minimum amount of data for each thread, below this starting a thread costs more than it saves
+const size_t min_bytes_per_thread = 1 << 18;
+
+void parallel_rows(int rows, size_t bytes_per_row, const function<void(int begin, int end)>& f) {
+  size_t threads = min((size_t)max(1u, thread::hardware_concurrency()), rows * bytes_per_row / min_bytes_per_thread);
+  threads = min(threads, (size_t)rows);
+  if (threads <= 1) {
+    f(0, rows);
+    return;
+  }
+  // the last strip is done on this thread
+  vector<future<void>> strips;
+  for (size_t i = 0 ; i + 1 < threads ; ++i) {
+    strips.push_back(async(launch::async, f, int(rows * i / threads), int(rows * (i + 1) / threads)));
+  }
+  f(int(rows * (threads - 1) / threads), rows);
+  for (auto& strip : strips) {
+    strip.get(); // wait, and pass on exceptions
+  }
+}
@@ -17,6 +17,45 @@
 //  we will get errors if 2^shift * imagesize becomes too large
 const int shift = 32-10-8; // => max size = 1024, max alpha = 255
 
+/// How much each input pixel contributes to each output pixel in a resample pass
+/** Each input pixel becomes a fixed amount of output (in 1<<shift fixed point math),
+ *  output pixel x gets the amounts weights[start[x]..start[x+1]) of the input pixels first[x], first[x]+1, ...
+ *  The weights for each output pixel sum to 1<<shift.
+ *  The weights are the same for every line, so they are determined once per pass.
+ */
+struct ResampleWeights {
+  ResampleWeights(int length_in, int length_out);
+  vector<int>  first, start;
+  vector<UInt> weights;
+};
+
+ResampleWeights::ResampleWeights(int length_in, int length_out) {
+  int out_fact = (length_out << shift) / length_in; // how much to output for 256 input = 1 pixel
+  int out_rest = (length_out << shift) % length_in;
+  UInt in_rem = out_fact + out_rest; // remaining to input from the current input pixel
+  int in = 0;
+  first.reserve(length_out);
+  start.reserve(length_out + 1);
+  for (int x = 0 ; x < length_out ; ++x) {
+    first.push_back(in);
+    start.push_back((int)weights.size());
+    UInt out_rem = 1 << shift;
+    while (out_rem >= in_rem && in < length_in) {
+      // eat a whole input pixel
+      weights.push_back(in_rem);
+      out_rem -= in_rem;
+      in_rem = out_fact;
+      ++in;
+    }
+    if (out_rem > 0 && in < length_in) {
+      // eat a partial input pixel
+      weights.push_back(out_rem);
+      in_rem -= out_rem;
+    }
+  }
+  start.push_back((int)weights.size());
+}
+
 // Resample an image only in a single direction, either horizontally or vertically
 /* Terms are based on x resampling (keeping the same number of lines):
  *  offset     = number of elements to skip at the start
@@ -25,6 +64,9 @@ const int shift = 32-10-8; // => max size = 1024, max alpha = 255
  *  lines      = number of lines
  *  line_delta = number of elements between the the first pixel of two lines
  *  1 element = 3 bytes in data, 1 byte in alpha
+ *
+ * When the pixels of a line are adjacent in memory the image is processed one line at a time,
+ * otherwise one output pixel is determined for all lines at once, so memory is still read in order.
  */
 void resample_pass(const Image& img_in, Image& img_out, int offset_in, int offset_out,
                    int length_in, int delta_in, int length_out, int delta_out,
@@ -32,79 +74,111 @@ void resample_pass(const Image& img_in, Image& img_out, int offset_in, int offse
 {
   bool alpha = img_in.HasAlpha();
   if (alpha && !img_out.HasAlpha()) img_out.InitAlpha();
-  int out_fact = (length_out << shift) / length_in; // how much to output for 256 input = 1 pixel
-  int out_rest = (length_out << shift) % length_in;
-  // for each line
-  for (int l = 0 ; l < lines ; ++l) {
-    Byte* in  = img_in .GetData() + 3 * (offset_in  + l * line_delta_in);
-    Byte* out = img_out.GetData() + 3 * (offset_out + l * line_delta_out);
-    UInt in_rem = out_fact + out_rest; // remaining to input from the current input pixel
-    
-    if (alpha) {
-      Byte* in_a  = img_in .GetAlpha() + (offset_in  + l * line_delta_in);
-      Byte* out_a = img_out.GetAlpha() + (offset_out + l * line_delta_out);
-      
-      for (int x = 0 ; x < length_out ; ++x) {
-        UInt out_rem = 1 << shift;
-        UInt totR = 0, totG = 0, totB = 0, totA = 0;
-        while (out_rem >= in_rem) {
-          // eat a whole input pixel
-          totR += in[0]   * in_rem * in_a[0]; // multiply by alpha
-          totG += in[1]   * in_rem * in_a[0];
-          totB += in[2]   * in_rem * in_a[0];
-          totA += in_a[0] * in_rem;
-          out_rem -= in_rem;
-          in_rem = out_fact;
-          in += 3*delta_in; in_a += delta_in;
-        }
-        if (out_rem > 0) {
-          // eat a partial input pixel
-          totR += in[0]   * out_rem * in_a[0];
-          totG += in[1]   * out_rem * in_a[0];
-          totB += in[2]   * out_rem * in_a[0];
-          totA += in_a[0] * out_rem;
-          in_rem -= out_rem;
-        }
-        // store
-        if (totA) {
-          out[0] = totR / totA;
-          out[1] = totG / totA;
-          out[2] = totB / totA;
-          out_a[0] = totA >> shift;
-        } else {
-          out[0] = out[1] = out[2] = out_a[0] = 0; // div by 0 is bad
+  ResampleWeights rw(length_in, length_out);
+  Byte* data_in  = img_in .GetData() + 3 * offset_in;
+  Byte* data_out = img_out.GetData() + 3 * offset_out;
+  Byte* alpha_in  = alpha ? img_in .GetAlpha() + offset_in  : nullptr;
+  Byte* alpha_out = alpha ? img_out.GetAlpha() + offset_out : nullptr;
+  
+  if (delta_in == 1) {
+    // for each line
+    parallel_rows(lines, 3 * length_in, [&](int begin, int end) {
+      for (int l = begin ; l < end ; ++l) {
+        Byte* in   = data_in  + 3 * l * line_delta_in;
+        Byte* out  = data_out + 3 * l * line_delta_out;
+        Byte* in_a = alpha ? alpha_in + l * line_delta_in : nullptr;
+        Byte* out_a = alpha ? alpha_out + l * line_delta_out : nullptr;
+        for (int x = 0 ; x < length_out ; ++x) {
+          const UInt* w = &rw.weights[rw.start[x]];
+          int n = rw.start[x+1] - rw.start[x];
+          int i = rw.first[x];
+          UInt totR = 0, totG = 0, totB = 0, totA = 0;
+          if (alpha) {
+            for (int j = 0 ; j < n ; ++j, ++i) {
+              UInt wa = w[j] * in_a[i]; // multiply by alpha
+              totR += in[3*i]   * wa;
+              totG += in[3*i+1] * wa;
+              totB += in[3*i+2] * wa;
+              totA += wa;
+            }
+            // store
+            if (totA) {
+              out[0] = totR / totA;
+              out[1] = totG / totA;
+              out[2] = totB / totA;
+              out_a[0] = totA >> shift;
+            } else {
+              out[0] = out[1] = out[2] = out_a[0] = 0; // div by 0 is bad
+            }
+            out_a += delta_out;
+          } else {
+            for (int j = 0 ; j < n ; ++j, ++i) {
+              totR += in[3*i]   * w[j];
+              totG += in[3*i+1] * w[j];
+              totB += in[3*i+2] * w[j];
+            }
+            // store
+            out[0] = totR >> shift;
+            out[1] = totG >> shift;
+            out[2] = totB >> shift;
+          }
+          out += 3*delta_out;
         }
-        out += 3*delta_out; out_a += delta_out;
       }
-      
-    } else {
-      // no alpha
+    });
+    
+  } else {
+    // for each output pixel, for all lines at once
+    parallel_rows(lines, 3 * length_in, [&](int begin, int end) {
+      int n = end - begin;
+      Byte* in_lines  = data_in + 3 * begin * line_delta_in;
+      Byte* out_lines = data_out + 3 * begin * line_delta_out;
+      Byte* in_lines_a  = alpha ? alpha_in  + begin * line_delta_in  : nullptr;
+      Byte* out_lines_a = alpha ? alpha_out + begin * line_delta_out : nullptr;
+      vector<UInt> totR(n), totG(n), totB(n), totA(alpha ? n : 0);
       for (int x = 0 ; x < length_out ; ++x) {
-        UInt out_rem = 1 << shift;
-        UInt totR = 0, totG = 0, totB = 0;
-        while (out_rem >= in_rem) {
-          // eat a whole input pixel
-          totR += in[0] * in_rem;
-          totG += in[1] * in_rem;
-          totB += in[2] * in_rem;
-          out_rem -= in_rem;
-          in_rem = out_fact;
-          in += 3*delta_in;
-        }
-        if (out_rem > 0) {
-          // eat a partial input pixel
-          totR += in[0] * out_rem;
-          totG += in[1] * out_rem;
-          totB += in[2] * out_rem;
-          in_rem -= out_rem;
+        fill(totR.begin(), totR.end(), 0);
+        fill(totG.begin(), totG.end(), 0);
+        fill(totB.begin(), totB.end(), 0);
+        fill(totA.begin(), totA.end(), 0);
+        for (int k = rw.start[x], i = rw.first[x] ; k < rw.start[x+1] ; ++k, ++i) {
+          UInt w = rw.weights[k];
+          Byte* in = in_lines + 3 * i * delta_in;
+          if (alpha) {
+            Byte* in_a = in_lines_a + i * delta_in;
+            for (int l = 0 ; l < n ; ++l) {
+              UInt wa = w * in_a[l * line_delta_in]; // multiply by alpha
+              totR[l] += in[3 * l * line_delta_in]     * wa;
+              totG[l] += in[3 * l * line_delta_in + 1] * wa;
+              totB[l] += in[3 * l * line_delta_in + 2] * wa;
+              totA[l] += wa;
+            }
+          } else {
+            for (int l = 0 ; l < n ; ++l) {
+              totR[l] += in[3 * l * line_delta_in]     * w;
+              totG[l] += in[3 * l * line_delta_in + 1] * w;
+              totB[l] += in[3 * l * line_delta_in + 2] * w;
+            }
+          }
         }
         // store
-        out[0] = totR >> shift;
-        out[1] = totG >> shift;
-        out[2] = totB >> shift;
-        out += 3*delta_out;
+        Byte* out = out_lines + 3 * x * delta_out;
+        for (int l = 0 ; l < n ; ++l, out += 3 * line_delta_out) {
+          if (!alpha) {
+            out[0] = totR[l] >> shift;
+            out[1] = totG[l] >> shift;
+            out[2] = totB[l] >> shift;
+          } else if (totA[l]) {
+            out[0] = totR[l] / totA[l];
+            out[1] = totG[l] / totA[l];
+            out[2] = totB[l] / totA[l];
+            out_lines_a[x * delta_out + l * line_delta_out] = totA[l] >> shift;
+          } else {
+            out[0] = out[1] = out[2] = out_lines_a[x * delta_out + l * line_delta_out] = 0; // div by 0 is bad
+          }
+        }
       }
-    }
+    });
   }
 }
 
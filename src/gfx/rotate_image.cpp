@@ -21,23 +21,29 @@ Image rotate_image_impl(Image img) {
   Rotater::init(ret, width, height);
   Byte* in = img.GetData(), *out = ret.GetData();
   // rotate each pixel
-  for (UInt y = 0 ; y < height ; ++y) {
-    for (UInt x = 0 ; x < width ; ++x) {
-      memcpy(out + 3 * Rotater::offset(x, y, width, height), in, 3);
-      in += 3;
+  parallel_rows(height, 3 * width, [=](int begin, int end) {
+    Byte* in_row = in + 3 * width * begin;
+    for (UInt y = begin ; y < (UInt)end ; ++y) {
+      for (UInt x = 0 ; x < width ; ++x) {
+        memcpy(out + 3 * Rotater::offset(x, y, width, height), in_row, 3);
+        in_row += 3;
+      }
     }
-  }
+  });
   // don't forget alpha
   if (img.HasAlpha()) {
     ret.InitAlpha();
     in  = img.GetAlpha();
     out = ret.GetAlpha();
-    for (UInt y = 0 ; y < height ; ++y) {
-      for (UInt x = 0 ; x < width ; ++x) {
-        out[Rotater::offset(x, y, width, height)] = *in;
-        in += 1;
+    parallel_rows(height, width, [=](int begin, int end) {
+      Byte* in_row = in + width * begin;
+      for (UInt y = begin ; y < (UInt)end ; ++y) {
+        for (UInt x = 0 ; x < width ; ++x) {
+          out[Rotater::offset(x, y, width, height)] = *in_row;
+          in_row += 1;
+        }
       }
-    }
+    });
   }
   // ret is rotated image
   return ret;
@@ -183,8 +183,35 @@ bool CardListBase::doDelete() {
 
 // ----------------------------------------------------------------------------- : CardListBase : Building the list
 
+// Determine the sort keys once, instead of in every comparison
+void CardListBase::prepareSort(const vector<VoidP>& items) {
+  sort_keys.clear();
+  FieldP sort_field = column_fields[sort_by_column];
+  FOR_EACH_CONST(item, items) {
+    Card* card = reinterpret_cast<Card*>(item.get());
+    pair<String,String>& keys = sort_keys[card];
+    keys.first = card->data[sort_field]->getSortKey();
+    if (alternate_sort_field) {
+      keys.second = card->data[alternate_sort_field]->getSortKey();
+    }
+  }
+}
+
+// The keys are only valid while sorting, cards can be changed or deleted afterwards
+void CardListBase::finishSort() {
+  sort_keys.clear();
+}
+
 // Comparison object for comparing cards
 bool CardListBase::compareItems(void* a, void* b) const {
+  auto ka = sort_keys.find(a), kb = sort_keys.find(b);
+  if (ka != sort_keys.end() && kb != sort_keys.end()) {
+    int cmp = smart_compare(ka->second.first, kb->second.first);
+    if (cmp == 0 && alternate_sort_field) {
+      cmp = smart_compare(ka->second.second, kb->second.second);
+    }
+    return cmp < 0;
+  }
   FieldP sort_field = column_fields[sort_by_column];
   ValueP va = reinterpret_cast<Card*>(a)->data[sort_field];
   ValueP vb = reinterpret_cast<Card*>(b)->data[sort_field];
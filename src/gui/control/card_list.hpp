@@ -108,6 +108,8 @@ protected:
   void sendEvent(int type = EVENT_CARD_SELECT);
   /// Compare cards
   bool compareItems(void* a, void* b) const override;
+  void prepareSort(const vector<VoidP>& items) override;
+  void finishSort() override;
   
   // --------------------------------------------------- : Item 'events'
   
@@ -125,6 +127,8 @@ private:
   // display stuff
   vector<FieldP> column_fields; ///< The field to use for each column (by column index)
   FieldP alternate_sort_field;  ///< Second field to sort by, if the column doesn't suffice
+  /// Sort keys of the sort field and alternate sort field of each card, only filled while sorting
+  unordered_map<const void*, pair<String,String>> sort_keys;
   
   mutable wxListItemAttr item_attr; // for OnGetItemAttr
   
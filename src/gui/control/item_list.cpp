@@ -170,7 +170,9 @@ void ItemList::refreshList(bool refresh_current_only) {
   getItems(sorted_list);
   // Sort the list
   if (sort_by_column >= 0) {
+    prepareSort(sorted_list);
     stable_sort(sorted_list.begin(), sorted_list.end(), ItemComparer(*this));
+    finishSort();
   }
   // Has the entire list changed?
   if (refresh_current_only && sorted_list == old_sorted_list) {
@@ -67,6 +67,10 @@ protected:
   virtual bool mustSort() const { return false; }
   /// Compare two items for < based on sort_by_column (not on sort_ascending)
   virtual bool compareItems(void* a, void* b) const = 0;
+  /// Called before the items are sorted, so compareItems doesn't have to determine the same keys over and over
+  virtual void prepareSort(const vector<VoidP>& items) {}
+  /// Called after the items are sorted, to release whatever prepareSort determined
+  virtual void finishSort() {}
   
   // --------------------------------------------------- : Protected interface
   /// Return the card at the given position in the sorted list
@@ -54,6 +54,7 @@ HtmlExportWindow::HtmlExportWindow(Window* parent, const SetP& set, const Export
 
 ScriptValueP export_set(SetP const& set, vector<CardP> const& cards, ExportTemplateP const& exp, String const& outname) {
   wxBusyCursor wait;
+  set->updateDelayed();
   // export info for script
   ExportInfo info;
   info.export_template = exp;
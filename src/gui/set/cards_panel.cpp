@@ -344,6 +344,7 @@ void CardsPanel::onCommand(int id) {
     }
     case ID_CARD_FILTER: {
       // card filter has changed, update the card list
+      set->updateDelayed(); // the filter looks at the values of all cards
       card_list->setFilter(filter->getFilter<Card>());
       break;
     }
@@ -455,6 +456,7 @@ bool CardsPanel::doReplaceAll(wxFindReplaceData& what) {
 }
 
 bool CardsPanel::search(FindInfo& find, bool from_start) {
+  set->updateDelayed();
   bool include = from_start;
   CardP current = card_list->getCard();
   for (size_t i = 0 ; i < set->cards.size() ; ++i) {
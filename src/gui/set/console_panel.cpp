@@ -561,6 +561,7 @@ void ConsolePanel::exec(String const& command) {
     if (!script) return;
     // execute command
     //WITH_DYNAMIC_ARG(export_info, &ei); // TODO: allow image export
+    set->updateDelayed(); // the command can look at any card
     Context& ctx = set->getContext(card);
     ScriptValueP result = ctx.eval(*script,false);
     get_pending_errors();
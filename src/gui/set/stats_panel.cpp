@@ -428,6 +428,7 @@ void StatsPanel::onChange() {
 
 void StatsPanel::showCategory(const GraphType* prefer_layout) {
   up_to_date = true;
+  set->updateDelayed(); // statistics need the values of all cards
   // find dimensions and layout
   #if USE_DIMENSION_LISTS || USE_SEPARATE_DIMENSION_LISTS
     // dimensions
@@ -850,6 +850,10 @@ void SetWindow::onMenuOpen(wxMenuEvent& ev) {
 void SetWindow::onIdle(wxIdleEvent& ev) {
   // Stuff that must be done in the main thread
   show_update_dialog(this);
+  // Catch up with script updates that were delayed, a little bit at a time
+  if (set && set->updateDelayedStep()) {
+    ev.RequestMore();
+  }
 }
 
 // ----------------------------------------------------------------------------- : Event table
@@ -512,7 +512,7 @@ String spellcheck_word_at(const String& str, size_t start) {
   return untag(str.substr(start,end-start));
 }
 
-void spellcheck_language_at(const String& str, size_t error_pos, SpellChecker** out) {
+void spellcheck_language_at(const String& str, size_t error_pos, SpellCheckerP* out) {
   String tag  = tag_at(str,error_pos);
   size_t pos  = min(tag.find_first_of(_(':')), tag.size()-1);
   size_t pos2 = min(tag.find_first_of(_(':'),pos+1), tag.size());
@@ -528,7 +528,7 @@ void spellcheck_language_at(const String& str, size_t error_pos, SpellChecker**
 void get_spelling_suggestions(const String& str, size_t error_pos, vector<String>& suggestions_out) {
   String word = spellcheck_word_at(str, error_pos);
   // find dictionaries
-  SpellChecker* checkers[3] = {nullptr};
+  SpellCheckerP checkers[3];
   spellcheck_language_at(str, error_pos, checkers);
   // suggestions
   for (size_t i = 0 ; checkers[i] ; ++i) {
@@ -737,6 +737,7 @@ RealRect TextValueEditor::boundingBoxBorder() const {
 
 void TextValueEditor::onValueChange() {
   TextValueViewer::onValueChange();
+  cursor_index.reset();
   selection_start   = selection_end   = 0;
   selection_start_i = selection_end_i = 0;
   findWordLists();
@@ -744,6 +745,7 @@ void TextValueEditor::onValueChange() {
 
 void TextValueEditor::onAction(const Action& action, bool undone) {
   TextValueViewer::onAction(action, undone);
+  cursor_index.reset(); // the value has changed (value actions, undo, or script updates)
   findWordLists();
   TYPE_CASE(action, TextValueAction) {
     selection_start = action.selection_start;
@@ -1076,29 +1078,37 @@ Movement direction_of(size_t a, size_t b) {
   else       return MOVE_MID;
 }
 
+const CursorIndex& TextValueEditor::cursorIndex() const {
+  if (!cursor_index) {
+    cursor_index = make_unique<CursorIndex>(value().value());
+  }
+  return *cursor_index;
+}
+
 void TextValueEditor::fixSelection(IndexType t, Movement dir) {
   const String& val = value().value();
+  const CursorIndex& cursors = cursorIndex();
   // Which type takes precedent?
   if (t == TYPE_INDEX) {
-    selection_start = index_to_cursor(value().value(), selection_start_i, dir);
-    selection_end   = index_to_cursor(value().value(), selection_end_i,   dir);
+    selection_start = cursors.indexToCursor(val, selection_start_i, dir);
+    selection_end   = cursors.indexToCursor(val, selection_end_i,   dir);
   }
   // make sure the selection is at a valid position inside the text
   // prepare to move 'inward' (i.e. from start in the direction of end and vice versa)
-  selection_start_i = cursor_to_index(val, selection_start, direction_of(selection_end, selection_start));
-  selection_end_i   = cursor_to_index(val, selection_end,   direction_of(selection_start, selection_end));
+  selection_start_i = cursors.cursorToIndex(val, selection_start, direction_of(selection_end, selection_start));
+  selection_end_i   = cursors.cursorToIndex(val, selection_end,   direction_of(selection_start, selection_end));
   // start and end must be on the same side of separators
   size_t seppos = val.find(_("<sep"));
   while (seppos != String::npos) {
     size_t sepend = match_close_tag_end(val, seppos);
     if (selection_start_i <= seppos && selection_end_i > seppos) {
         // not on same side, move selection end before sep
-      selection_end   = index_to_cursor(val, seppos, dir);
-      selection_end_i = cursor_to_index(val, selection_end, direction_of(selection_start, selection_end));
+      selection_end   = cursors.indexToCursor(val, seppos, dir);
+      selection_end_i = cursors.cursorToIndex(val, selection_end, direction_of(selection_start, selection_end));
     } else if (selection_start_i >= sepend && selection_end_i < sepend) {
         // not on same side, move selection end after sep
-      selection_end   = index_to_cursor(val, sepend, dir);
-      selection_end_i = cursor_to_index(val, selection_end, direction_of(selection_start, selection_end));
+      selection_end   = cursors.indexToCursor(val, sepend, dir);
+      selection_end_i = cursors.cursorToIndex(val, selection_end, direction_of(selection_start, selection_end));
     }
     // find next separator
     seppos = val.find(_("<sep"), seppos + 1);
@@ -1110,7 +1120,7 @@ size_t TextValueEditor::prevCharBoundary(size_t pos) const {
   return max(0, (int)pos - 1);
 }
 size_t TextValueEditor::nextCharBoundary(size_t pos) const {
-  return min(index_to_cursor(value().value(), String::npos), pos + 1);
+  return min(cursorIndex().indexToCursor(value().value(), String::npos), pos + 1);
 }
 
 static const Char word_bound_chars[] = _(" ,.:;()\n");
@@ -105,9 +105,13 @@ private:
   TextValueEditorScrollBar* scrollbar;       ///< Scrollbar for multiline fields in native look
   bool scroll_with_cursor;                   ///< When the cursor moves, should the scrollposition change?
   vector<WordListPosP> word_lists;           ///< Word lists in the text
+  mutable unique_ptr<CursorIndex> cursor_index; ///< Cursor positions of the value, reset by onValueChange and onAction
   
   // --------------------------------------------------- : Selection / movement
   
+  /// Cursor positions of the current value
+  const CursorIndex& cursorIndex() const;
+  
   /// Move the selection to a new location, clears the previously drawn selection.
   /** t specifies what kind of position new_end is */
   void moveSelection(IndexType t, size_t new_end, bool also_move_start=true, Movement dir = MOVE_MID);
@@ -9,6 +9,7 @@
 #include <util/prec.hpp>
 #include <util/io/package_manager.hpp>
 #include <util/spell_checker.hpp>
+#include <script/script_cache.hpp>
 #include <data/game.hpp>
 #include <data/set.hpp>
 #include <data/settings.hpp>
@@ -293,6 +294,7 @@ int MSE::runGUI() {
 int MSE::OnExit() {
   thumbnail_thread.abortAll();
   settings.write();
+  script_cache.write();
   package_manager.destroy();
   SpellChecker::destroyAll();
   return 0;
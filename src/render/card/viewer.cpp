@@ -133,6 +133,7 @@ void DataViewer::setCard(const CardP& card, bool refresh) {
   StyleSheetP new_stylesheet = set->stylesheetForP(card);
   if (!refresh && this->card == card && this->stylesheet == new_stylesheet) return; // already set
   assert(set);
+  set->updateDelayed(card);
   this->card = card;
   stylesheet = new_stylesheet;
   setStyles(stylesheet, stylesheet->card_style, &stylesheet->extra_card_style);
@@ -10,6 +10,8 @@
 #include <script/context.hpp>
 #include <script/to_value.hpp>
 #include <script/profiler.hpp>
+#include <script/functions/functions.hpp>
+#include <data/field.hpp>
 #include <util/error.hpp>
 #include <iostream>
 
@@ -17,6 +19,8 @@
 
 Context::Context()
   : level(0)
+  , recording(nullptr)
+  , recording_level(0)
 {}
 
 // ----------------------------------------------------------------------------- : Evaluate
@@ -27,6 +31,9 @@ void instrUnary  (UnaryInstructionType   i, ScriptValueP& a);
 // Perform a binary simple instruction, store the result in a (not in *a)
 void instrBinary (BinaryInstructionType  i, ScriptValueP& a, const ScriptValueP& b);
 
+// Perform a binary simple instruction, and return the result as a boolean, a may be overwritten
+bool instrBinaryCondition(BinaryInstructionType i, ScriptValueP& a, const ScriptValueP& b);
+
 // Perform a ternary simple instruction, store the result in a (not in *a)
 void instrTernary(TernaryInstructionType i, ScriptValueP& a, const ScriptValueP& b, const ScriptValueP& c);
 
@@ -51,7 +58,8 @@ ScriptValueP Context::eval(const Script& script, bool useScope) {
       // Evaluate the current instruction
       Instruction i = *instr++;
       // If a scope is created, destroy it at end of block.
-      unique_ptr<LocalScope> new_scope;
+      // It lives on the C++ stack, so calls don't need to allocate anything for it.
+      optional<LocalScope> new_scope;
 
       switch (i.instr) {
         case I_NOP: break;
@@ -96,8 +104,9 @@ ScriptValueP Context::eval(const Script& script, bool useScope) {
         
         // Get a variable
         case I_GET_VAR: {
-          ScriptValueP value = variables[i.data].value;
+          const ScriptValueP& value = variables[i.data].value;
           if (!value) throw ScriptErrorNoVariable(variable_to_string((Variable)i.data));
+          if (recording) recordVariable((Variable)i.data, value);
           stack.push_back(value);
           break;
         }
@@ -109,7 +118,7 @@ ScriptValueP Context::eval(const Script& script, bool useScope) {
         
         // Get an object member
         case I_MEMBER_C: {
-          stack.back() = stack.back()->getMember(script.constants[i.data]->toString());
+          stack.back() = getMemberC(script, stack.back(), i.data);
           break;
         }
         // Loop over a container, push next value or jump
@@ -146,19 +155,20 @@ ScriptValueP Context::eval(const Script& script, bool useScope) {
         
         // Function call
         case I_CALL:
-          new_scope.reset(new LocalScope(*this)); //new scope
+          new_scope.emplace(*this); //new scope
         case I_TAILCALL: {
           // prepare arguments
           for (unsigned int j = 0 ; j < i.data ; ++j) {
             setVariable((Variable)instr[i.data - j - 1].data, stack.back());
             stack.pop_back();
           }
+          if (recording) recordCall(*stack.back(), instr, i.data);
           instr += i.data; // skip arguments
           try {
             #if USE_SCRIPT_PROFILING
               Timer timer;
               const Instruction* instr_bt = script.backtraceSkip(instr - i.data - 2, i.data);
-              Variable function = instr_bt && instr_bt->instr == I_GET_VAR
+              Variable function = instr_bt && (instr_bt->instr == I_GET_VAR || instr_bt->instr == I_GET_VAR_MEMBER_C)
                                 ? (Variable)instr_bt->data
                                 : (Variable)-1;
               Profiler prof(timer, function);
@@ -199,29 +209,36 @@ ScriptValueP Context::eval(const Script& script, bool useScope) {
         
         // Simple instruction: unary
         case I_UNARY: {
+          if (recording && i.instr1 == I_ITERATOR_C && stack.back()->type() != SCRIPT_COLLECTION) {
+            recording->cacheable = false; // iterating over an object reads all its members
+          }
           instrUnary(i.instr1, stack.back());
           break;
         }
         // Simple instruction: binary
         case I_BINARY: {
-          ScriptValueP  b = stack.back(); stack.pop_back();
+          ScriptValueP  b = move(stack.back()); stack.pop_back();
           ScriptValueP& a = stack.back();
-          instrBinary(i.instr2, a, b);
+          if (recording && i.instr2 == I_MEMBER) {
+            a = recordMember(a, b->toString());
+          } else {
+            instrBinary(i.instr2, a, b);
+          }
           break;
         }
         // Simple instruction: ternary
         case I_TERNARY: {
-          ScriptValueP  c = stack.back(); stack.pop_back();
-          ScriptValueP  b = stack.back(); stack.pop_back();
+          ScriptValueP  c = move(stack.back()); stack.pop_back();
+          ScriptValueP  b = move(stack.back()); stack.pop_back();
           ScriptValueP& a = stack.back();
           instrTernary(i.instr3, a, b, c);
           break;
         }
         // Simple instruction: quaternary
         case I_QUATERNARY: {
-          ScriptValueP  d = stack.back(); stack.pop_back();
-          ScriptValueP  c = stack.back(); stack.pop_back();
-          ScriptValueP  b = stack.back(); stack.pop_back();
+          ScriptValueP  d = move(stack.back()); stack.pop_back();
+          ScriptValueP  c = move(stack.back()); stack.pop_back();
+          ScriptValueP  b = move(stack.back()); stack.pop_back();
           ScriptValueP& a = stack.back();
           instrQuaternary(i.instr4, a, b, c, d);
           break;
@@ -237,6 +254,47 @@ ScriptValueP Context::eval(const Script& script, bool useScope) {
           stack.push_back(stack.at(stack.size() - i.data - 1));
           break;
         }
+        
+        // Superinstructions: get a variable, and then a member of it
+        case I_GET_VAR_MEMBER_C: {
+          ScriptValueP value = variables[i.data].value;
+          if (!value) throw ScriptErrorNoVariable(variable_to_string((Variable)i.data));
+          if (recording) recordVariable((Variable)i.data, value);
+          stack.push_back(getMemberC(script, value, (instr++)->data));
+          break;
+        }
+        // Superinstructions: binary instruction with a constant as second argument
+        case I_PUSH_CONST_BINARY: {
+          instrBinary((instr++)->instr2, stack.back(), script.constants[i.data]);
+          break;
+        }
+        // A call that was evaluated when the script was parsed
+        case I_CALL_FOLDED: {
+          // followed by: push result; get f; arguments; call
+          const Instruction& result = instr[0];
+          const Instruction& get    = instr[1];
+          const ScriptValueP& value = variables[get.data].value;
+          if (value && result.data < script.folded_functions.size() && value == script.folded_functions[result.data]) {
+            if (recording) recordVariable((Variable)get.data, value);
+            stack.push_back(script.constants[result.data]);
+            instr = &script.instructions[0] + i.data;
+          } else {
+            // the name is bound to something else, do the call
+            instr += 1;
+          }
+          break;
+        }
+        // Superinstructions: binary instruction followed by a conditional jump
+        case I_BINARY_JUMP_IF_NOT: {
+          ScriptValueP b = move(stack.back()); stack.pop_back();
+          bool condition = instrBinaryCondition(i.instr2, stack.back(), b);
+          stack.pop_back();
+          unsigned int target = (instr++)->data;
+          if (!condition) {
+            instr = &script.instructions[0] + target;
+          }
+          break;
+        }
       }
     }
     
@@ -257,6 +315,263 @@ ScriptValueP Context::eval(const Script& script, bool useScope) {
   }
 }
 
+// ----------------------------------------------------------------------------- : Result cache
+
+/// Maximum number of earlier results kept for each script
+static const size_t MAX_SCRIPT_MEMOS = 4;
+
+/// The identity of an object, recorded without keeping the object alive
+class ScriptIdentity : public ScriptValue {
+public:
+  inline ScriptIdentity(const void* ptr) : ptr(ptr) {}
+  ScriptType type() const override { return SCRIPT_OBJECT; }
+  String typeName() const override { return _TYPE_("object"); }
+  CompareWhat compareAs(String&, void const*& compare_ptr) const override {
+    compare_ptr = ptr;
+    return COMPARE_AS_POINTER;
+  }
+  const void* const ptr;
+};
+
+/// The pointer that identifies an object, or nullptr if the value is not an object whose members can be recorded
+/** Besides objects this includes the field value maps like styling, their fields don't change.
+ */
+static const void* identity(const ScriptValueP& value) {
+  if (value->type() == SCRIPT_COLLECTION && !dynamic_cast<const ScriptMap<IndexMap<FieldP,ValueP>>*>(value.get())) {
+    return nullptr;
+  }
+  String      compare_str;
+  const void* compare_ptr = nullptr;
+  if (value->compareAs(compare_str, compare_ptr) != COMPARE_AS_POINTER) return nullptr;
+  return compare_ptr;
+}
+
+/// A copy of the current state of a value, that doesn't change when the value is modified later
+/** Objects are compared by identity, their members are recorded when they are read.
+ *  Functions and collections made by scripts never change, they are kept.
+ *  Returns nullptr if the value can't be recorded.
+ */
+static ScriptValueP snapshot(const ScriptValueP& value) {
+  switch (value->type()) {
+    case SCRIPT_NIL:    return script_nil;
+    case SCRIPT_INT:    return to_script(value->toInt());
+    case SCRIPT_BOOL:   return to_script(value->toBool());
+    case SCRIPT_DOUBLE: return to_script(value->toDouble());
+    case SCRIPT_STRING: return to_script(value->toString());
+    case SCRIPT_COLOR:  return to_script(value->toColor());
+    case SCRIPT_FUNCTION:
+      return value;
+    case SCRIPT_OBJECT: case SCRIPT_COLLECTION: {
+      // other collections can be modified in place
+      if (dynamic_cast<const ScriptCustomCollection*>(value.get())) return value;
+      const void* id = identity(value);
+      if (id) return make_intrusive<ScriptIdentity>(id);
+      return ScriptValueP();
+    }
+    default:
+      return ScriptValueP();
+  }
+}
+
+/// The result of an evaluation as it is stored in a memo
+/** Returns nullptr for results that refer to objects, those could be deleted while the memo is kept.
+ */
+static ScriptValueP memo_result(const ScriptValueP& value) {
+  switch (value->type()) {
+    case SCRIPT_NIL: case SCRIPT_INT: case SCRIPT_BOOL: case SCRIPT_DOUBLE: case SCRIPT_STRING: case SCRIPT_COLOR:
+      return snapshot(value);
+    case SCRIPT_OBJECT:
+      return ScriptValueP();
+    case SCRIPT_COLLECTION: {
+      const ScriptCustomCollection* col = dynamic_cast<const ScriptCustomCollection*>(value.get());
+      if (!col) return ScriptValueP();
+      FOR_EACH_CONST(v, col->value) {
+        if (memo_result(v) != v) return ScriptValueP();
+      }
+      FOR_EACH_CONST(v, col->key_value) {
+        if (memo_result(v.second) != v.second) return ScriptValueP();
+      }
+      return value;
+    }
+    default:
+      return value;
+  }
+}
+
+/// The identity recorded by a snapshot, or nullptr if it is not a snapshot of an object
+static const void* identity_of_snapshot(const ScriptValueP& snap) {
+  const ScriptIdentity* id = dynamic_cast<const ScriptIdentity*>(snap.get());
+  return id ? id->ptr : nullptr;
+}
+
+/// Does a value match a snapshot made earlier?
+static bool same_input(const ScriptValueP& value, const ScriptValueP& recorded) {
+  ScriptValueP now = snapshot(value);
+  if (!now) return false;
+  if (now == recorded) return true;
+  ScriptType type = now->type();
+  if (type != recorded->type()) return false;
+  if (type == SCRIPT_FUNCTION || type == SCRIPT_COLLECTION) return false; // by identity
+  return equal(now, recorded);
+}
+
+ScriptValueP Context::evalCached(const Script& script) {
+  // nested evaluations are part of the one being recorded
+  if (recording) return eval(script);
+  // is there an earlier result with the same inputs?
+  bool memoizable;
+  {
+    lock_guard<mutex> lock(script.memos_mutex);
+    memoizable = script.memoizable;
+    for (auto it = script.memos.begin() ; it != script.memos.end() ; ++it) {
+      if (sameInputs(*it)) {
+        ScriptValueP result = it->result;
+        if (it != script.memos.begin()) {
+          ScriptMemo memo = move(*it);
+          script.memos.erase(it);
+          script.memos.push_front(move(memo));
+        }
+        return result;
+      }
+    }
+  }
+  if (!memoizable) return eval(script);
+  // evaluate, and record the inputs
+  ScriptMemo memo;
+  recording       = &memo;
+  recording_level = level;
+  try {
+    memo.result = eval(script);
+  } catch (...) {
+    recording = nullptr;
+    throw;
+  }
+  recording = nullptr;
+  ScriptValueP result = memo.result;
+  lock_guard<mutex> lock(script.memos_mutex);
+  if (!memo.cacheable) {
+    script.memoizable = false;
+    script.memos.clear();
+  } else if ((memo.result = memo_result(result))) {
+    script.memos.push_front(move(memo));
+    if (script.memos.size() > MAX_SCRIPT_MEMOS) script.memos.pop_back();
+  }
+  return result;
+}
+
+ScriptValueP Context::evalRecorded(const ScriptValue& function, ScriptMemo& memo) {
+  // this can happen inside an evaluation that is being recorded by evalCached
+  ScriptMemo*  outer_recording = recording;
+  unsigned int outer_level     = recording_level;
+  recording       = &memo;
+  recording_level = level;
+  ScriptValueP result;
+  try {
+    result = function.eval(*this);
+  } catch (...) {
+    recording       = outer_recording;
+    recording_level = outer_level;
+    throw;
+  }
+  recording       = outer_recording;
+  recording_level = outer_level;
+  return result;
+}
+
+void Context::recordVariable(Variable var, const ScriptValueP& value) {
+  if (!recording->cacheable || variables[var].level > recording_level) return;
+  FOR_EACH_CONST(v, recording->variables) {
+    if (v.first == var) return; // already recorded
+  }
+  ScriptValueP snap = snapshot(value);
+  if (snap) {
+    recording->variables.push_back(make_pair(var, snap));
+  } else {
+    recording->cacheable = false;
+  }
+}
+
+ScriptValueP Context::recordMember(const ScriptValueP& object, const String& name) {
+  ScriptValueP value = object->getMember(name);
+  if (!recording->cacheable) return value;
+  // the object must have been read earlier, so the member can be read again from the object seen at that point
+  const void* id = identity(object);
+  bool   of_member = false;
+  size_t source    = recording->variables.size();
+  for (size_t i = 0 ; id && i < recording->variables.size() ; ++i) {
+    if (identity_of_snapshot(recording->variables[i].second) == id) { source = i; break; }
+  }
+  if (source == recording->variables.size()) {
+    of_member = true;
+    source    = recording->members.size();
+    for (size_t i = 0 ; id && i < recording->members.size() ; ++i) {
+      if (identity_of_snapshot(recording->members[i].value) == id) { source = i; break; }
+    }
+    if (source == recording->members.size()) {
+      recording->cacheable = false;
+      return value;
+    }
+  }
+  FOR_EACH_CONST(m, recording->members) {
+    if (m.of_member == of_member && m.source == source && m.name == name) return value; // already recorded
+  }
+  ScriptValueP snap = snapshot(value);
+  if (snap) {
+    recording->members.push_back(ScriptMemo::MemberRead{of_member, source, name, snap});
+  } else {
+    recording->cacheable = false;
+  }
+  return value;
+}
+
+ScriptValueP Context::getMemberC(const Script& script, const ScriptValueP& object, unsigned int c) {
+  if (c < script.member_caches.size()) {
+    MemberCache& cache = script.member_caches[c];
+    if (recording) return recordMember(object, cache.name);
+    return object->getMemberCached(cache.name, cache);
+  } else {
+    String name = script.constants[c]->toString();
+    if (recording) return recordMember(object, name);
+    return object->getMember(name);
+  }
+}
+
+void Context::recordCall(const ScriptValue& function, const Instruction* arguments, unsigned int count) {
+  // functions written in script code are recorded while they are evaluated
+  if (!recording->cacheable || dynamic_cast<const Script*>(&function)) return;
+  // built in functions can have hidden inputs, unless they are pure
+  vector<Variable> argument_names;
+  for (unsigned int j = 0 ; j < count ; ++j) {
+    argument_names.push_back((Variable)arguments[j].data);
+  }
+  if (!is_pure_script_call(function, argument_names)) {
+    recording->cacheable = false;
+  }
+}
+
+bool Context::sameInputs(const ScriptMemo& memo) {
+  try {
+    FOR_EACH_CONST(v, memo.variables) {
+      const ScriptValueP& value = variables[v.first].value;
+      if (!value || !same_input(value, v.second)) return false;
+    }
+    // objects are read from this context, those are the same objects as when the memo was recorded,
+    // the memo only holds snapshots, so it can be checked from any thread
+    vector<ScriptValueP> members;
+    members.reserve(memo.members.size());
+    FOR_EACH_CONST(m, memo.members) {
+      const ScriptValueP& object = m.of_member ? members[m.source] : variables[memo.variables[m.source].first].value;
+      members.push_back(object->getMember(m.name));
+      if (!same_input(members.back(), m.value)) return false;
+    }
+    return true;
+  } catch (const Error&) {
+    return false;
+  }
+}
+
+// ----------------------------------------------------------------------------- : Variables
+
 void Context::setVariable(const String& name, const ScriptValueP& value) {
   setVariable(string_to_variable(name), value);
 }
@@ -416,6 +731,18 @@ public:
     #endif
   }
 
+  /// Compose two functions, doing chains of simple replacements in a single pass when possible
+  static ScriptValueP compose(const ScriptValueP& a, const ScriptValueP& b) {
+    if (ScriptValueP fused = fuse_replace_functions(a, b)) return fused;
+    // (x + y) + b  -->  x + (y + b)
+    if (ScriptCompose* xy = dynamic_cast<ScriptCompose*>(a.get())) {
+      if (ScriptValueP fused = fuse_replace_functions(xy->b, b)) {
+        return make_intrusive<ScriptCompose>(xy->a, fused);
+      }
+    }
+    return make_intrusive<ScriptCompose>(a, b);
+  }
+
 private:
   ScriptValueP a,b;
 };
@@ -468,7 +795,7 @@ void instrBinary (BinaryInstructionType  i, ScriptValueP& a, const ScriptValueP&
       } else if (bt == SCRIPT_NIL) {
         // a = a;
       } else if (at == SCRIPT_FUNCTION && bt == SCRIPT_FUNCTION) {
-        a = make_intrusive<ScriptCompose>(a, b);
+        a = ScriptCompose::compose(a, b);
       } else if (at == SCRIPT_COLLECTION && bt == SCRIPT_COLLECTION) {
         a = make_intrusive<ScriptConcatCollection>(a, b);
       } else if (at == SCRIPT_INT    && bt == SCRIPT_INT) {
@@ -540,6 +867,33 @@ void instrBinary (BinaryInstructionType  i, ScriptValueP& a, const ScriptValueP&
   }}
 }
 
+// comparison of doubles or ints, without constructing a result value
+#define COMPARE_DI(OP) \
+  if (at == SCRIPT_DOUBLE || bt == SCRIPT_DOUBLE) { \
+    return a->toDouble() OP b->toDouble(); \
+  } else { \
+    return a->toInt() OP b->toInt(); \
+  }
+
+bool instrBinaryCondition(BinaryInstructionType i, ScriptValueP& a, const ScriptValueP& b) {
+  switch (i) {
+    case I_EQ:  return  equal(a,b);
+    case I_NEQ: return !equal(a,b);
+    case I_LT: case I_GT: case I_LE: case I_GE: {
+      ScriptType at = a->type(), bt = b->type();
+      switch (i) {
+        case I_LT: COMPARE_DI(<);
+        case I_GT: COMPARE_DI(>);
+        case I_LE: COMPARE_DI(<=);
+        default:   COMPARE_DI(>=);
+      }
+    }
+    default:
+      instrBinary(i, a, b);
+      return a->toBool();
+  }
+}
+
 // ----------------------------------------------------------------------------- : Simple instructions : ternary
 
 void instrTernary(TernaryInstructionType i, ScriptValueP& a, const ScriptValueP& b, const ScriptValueP& c) {
@@ -580,6 +934,7 @@ void Context::makeObject(size_t n) {
 
 void Context::makeClosure(size_t n, const Instruction*& instr) {
   intrusive_ptr<ScriptClosure> closure(new ScriptClosure(stack[stack.size() - n - 1]));
+  closure->bindings.reserve(n);
   for (size_t j = 0 ; j < n ; ++j) {
     closure->addBinding((Variable)instr[n - j - 1].data, stack.back());
     stack.pop_back();
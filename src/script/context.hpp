@@ -9,6 +9,7 @@
 // ----------------------------------------------------------------------------- : Includes
 
 #include <script/script.hpp>
+#include <optional>
 
 class Dependency;
 
@@ -44,6 +45,22 @@ public:
    */
   ScriptValueP eval(const Script& script, bool openScope = true);
   
+  /// Evaluate a script inside this context, reusing an earlier result if the inputs are the same.
+  /** The variables and object members read by the script are recorded with their values.
+   *  Evaluations that call functions with side effects or hidden inputs are not cached.
+   */
+  ScriptValueP evalCached(const Script& script);
+  
+  /// Evaluate a function, and record the variables and object members it reads in memo, like evalCached does.
+  /** If memo.cacheable is still true afterwards, then sameInputs(memo) tells whether the result would be the same.
+   *  Several evaluations can be recorded in the same memo.
+   */
+  ScriptValueP evalRecorded(const ScriptValue& function, ScriptMemo& memo);
+  /// Do the inputs of an earlier evaluation still have the same values?
+  /** Objects are looked up in the variables of this context, so the memo may have been recorded by another thread.
+   */
+  bool sameInputs(const ScriptMemo& memo);
+  
   /// Analyze the dependencies of a script
   /** All things the script depends on are marked with signalDependent(dep).
    *  The return value of this function should be ignored
@@ -102,6 +119,10 @@ private:
   vector<Binding> shadowed;
   /// Number of scopes opened
   unsigned int level;
+  /// Inputs of the evaluation that is being recorded by evalCached, or nullptr
+  ScriptMemo* recording;
+  /// Variables set at or below this level were set outside the evaluation being recorded
+  unsigned int recording_level;
   /// Stack of values
   vector<ScriptValueP> stack;
   #ifdef _DEBUG
@@ -122,6 +143,15 @@ private:
   /// Make a closure with n arguments
   void makeClosure(size_t n, const Instruction*& instr);
   
+  /// Record that a variable was read, if it was set outside the evaluation being recorded
+  void recordVariable(Variable var, const ScriptValueP& value);
+  /// Get a member of an object, and record that it was read
+  ScriptValueP recordMember(const ScriptValueP& object, const String& name);
+  /// Get a member of an object for I_MEMBER_C, the name is constant c of the script
+  ScriptValueP getMemberC(const Script& script, const ScriptValueP& object, unsigned int c);
+  /// Record a call of a function, with the names of its arguments
+  void recordCall(const ScriptValue& function, const Instruction* arguments, unsigned int count);
+  
   /// Get a variable name givin its value, returns (Variable)-1 if not found (slow!)
   Variable lookupVariableValue(const ScriptValueP& value);
   friend class ScriptCompose;
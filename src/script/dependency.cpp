@@ -169,11 +169,17 @@ ScriptValueP Context::dependencies(const Dependency& dep, const Script& script)
       if (instr >= &script.instructions[0] + script.instructions.size()) break; // end of script
       
       // Analyze the current instruction
+      // superinstructions are analyzed as their first half, the second half is the next instruction
       Instruction i = *instr++;
       switch (i.instr) {
         case I_NOP: break;
+        // Folded call: analyze the call itself, without the result pushed by the next instruction
+        case I_CALL_FOLDED: {
+          instr += 1;
+          break;
+        }
         // Push a constant (as normal)
-        case I_PUSH_CONST: {
+        case I_PUSH_CONST: case I_PUSH_CONST_BINARY: {
           stack.push_back(script.constants[i.data]);
           break;
         }
@@ -287,7 +293,7 @@ ScriptValueP Context::dependencies(const Dependency& dep, const Script& script)
         }
         
         // Get a variable (almost as normal)
-        case I_GET_VAR: {
+        case I_GET_VAR: case I_GET_VAR_MEMBER_C: {
           ScriptValueP value = variables[i.data].value;
           if (!value) {
             value = make_intrusive<ScriptMissingVariable>(variable_to_string((Variable)i.data)); // no errors here
@@ -315,7 +321,7 @@ ScriptValueP Context::dependencies(const Dependency& dep, const Script& script)
           break;
         }
         // Simple instruction: binary
-        case I_BINARY: {
+        case I_BINARY: case I_BINARY_JUMP_IF_NOT: {
           ScriptValueP  b = stack.back(); stack.pop_back();
           ScriptValueP& a = stack.back();
           switch (i.instr2) {
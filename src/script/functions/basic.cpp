@@ -664,13 +664,7 @@ SCRIPT_FUNCTION_WITH_DEP(expand_keywords) {
   SCRIPT_OPTIONAL_PARAM_N_(ScriptValueP, _("condition"), match_condition);
   SCRIPT_OPTIONAL_PARAM_(ScriptValueP, default_expand);
   SCRIPT_PARAM(ScriptValueP, combine);
-  KeywordDatabase& db = set->keyword_db;
-  if (db.empty()) {
-    db.prepare_parameters(set->game->keyword_parameter_types, set->keywords);
-    db.prepare_parameters(set->game->keyword_parameter_types, set->game->keywords);
-    db.add(set->keywords);
-    db.add(set->game->keywords);
-  }
+  KeywordDatabase& db = set->keywordDatabase();
   SCRIPT_OPTIONAL_PARAM_C_(CardP, card);
   try {
     KeywordUsageStatistics* stat = card ? &card->keyword_usage : nullptr;
@@ -724,6 +718,66 @@ SCRIPT_FUNCTION(rule) {
   return make_intrusive<ScriptRule>(input);
 }
 
+// ----------------------------------------------------------------------------- : Pure functions
+
+/// A built in function that only looks at its parameters
+struct PureFunction {
+  Variable         name;
+  ScriptValueP     function;
+  vector<Variable> parameters; ///< All parameters of the function, sorted
+};
+
+static const vector<PureFunction>& pure_functions() {
+  static const vector<PureFunction> functions = [] {
+    Variable exponent = string_to_variable(_("exponent"));
+    vector<PureFunction> functions;
+    #define PURE(name, ...) functions.push_back(PureFunction{string_to_variable(_(#name)), script_##name, {__VA_ARGS__}})
+    PURE(to_int,     SCRIPT_VAR_input);
+    PURE(to_real,    SCRIPT_VAR_input);
+    PURE(to_number,  SCRIPT_VAR_input);
+    PURE(to_boolean, SCRIPT_VAR_input);
+    PURE(abs,        SCRIPT_VAR_input);
+    PURE(sin,        SCRIPT_VAR_input);
+    PURE(cos,        SCRIPT_VAR_input);
+    PURE(tan,        SCRIPT_VAR_input);
+    PURE(sin_deg,    SCRIPT_VAR_input);
+    PURE(cos_deg,    SCRIPT_VAR_input);
+    PURE(tan_deg,    SCRIPT_VAR_input);
+    PURE(exp,        SCRIPT_VAR_input);
+    PURE(log,        SCRIPT_VAR_input);
+    PURE(log10,      SCRIPT_VAR_input);
+    PURE(sqrt,       SCRIPT_VAR_input);
+    PURE(pow,        SCRIPT_VAR_input, exponent);
+    PURE(to_upper,   SCRIPT_VAR_input);
+    PURE(to_lower,   SCRIPT_VAR_input);
+    PURE(to_title,   SCRIPT_VAR_input);
+    PURE(reverse,    SCRIPT_VAR_input);
+    PURE(trim,       SCRIPT_VAR_input);
+    PURE(substring,  SCRIPT_VAR_input, SCRIPT_VAR_begin, SCRIPT_VAR_end);
+    PURE(contains,   SCRIPT_VAR_input, SCRIPT_VAR_match);
+    #undef PURE
+    for (auto& f : functions) sort(f.parameters.begin(), f.parameters.end());
+    return functions;
+  }();
+  return functions;
+}
+
+ScriptValueP pure_script_function(Variable var, vector<Variable> arguments) {
+  sort(arguments.begin(), arguments.end());
+  for (const PureFunction& f : pure_functions()) {
+    if (f.name == var && f.parameters == arguments) return f.function;
+  }
+  return ScriptValueP();
+}
+
+bool is_pure_script_call(const ScriptValue& function, vector<Variable> arguments) {
+  sort(arguments.begin(), arguments.end());
+  for (const PureFunction& f : pure_functions()) {
+    if (f.function.get() == &function && f.parameters == arguments) return true;
+  }
+  return false;
+}
+
 // ----------------------------------------------------------------------------- : Init
 
 void init_script_basic_functions(Context& ctx) {
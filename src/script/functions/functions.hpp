@@ -14,6 +14,7 @@
 // ----------------------------------------------------------------------------- : Includes
 
 #include <util/prec.hpp>
+#include <script/script.hpp>
 
 class Context;
 
@@ -28,6 +29,19 @@ void init_script_english_functions(Context& ctx);
 void init_script_spelling_functions(Context& ctx);
 void init_script_construction_functions(Context& ctx);
 
+/// Find a built in function without side effects, that can be evaluated when a script is parsed
+/** Returns nullptr if var doesn't name such a function, or if the arguments are not exactly its parameters,
+ *  since other parameters would be looked up in the scope of the caller.
+ */
+ScriptValueP pure_script_function(Variable var, vector<Variable> arguments);
+/// Is this a call of a built in function without side effects, with exactly its parameters as arguments?
+bool is_pure_script_call(const ScriptValue& function, vector<Variable> arguments);
+
+/// Compose two functions that replace literal text, a + b, into a function that does both in a single pass
+/** Returns nullptr if they are not such functions, or if they could see each other's replacements.
+ */
+ScriptValueP fuse_replace_functions(const ScriptValueP& a, const ScriptValueP& b);
+
 /// Initialize all built in functions for a context
 inline void init_script_functions(Context& ctx) {
   init_script_basic_functions(ctx);
@@ -11,6 +11,8 @@
 #include <script/functions/util.hpp>
 #include <util/regex.hpp>
 #include <util/error.hpp>
+#include <list>
+#include <mutex>
 
 DECLARE_POINTER_TYPE(ScriptRegex);
 
@@ -22,10 +24,12 @@ public:
   ScriptType type() const override { return SCRIPT_REGEX; }
   String typeName() const override { return _("regex"); }
   
-  ScriptRegex(const String& code) {
+  ScriptRegex(const String& code) : code(code) {
     assign(code);
   }
   
+  const String code; ///< The pattern this regex was compiled from
+  
   /// Match only if in_context also matches
   bool matches(Results& results, const String& str, String::const_iterator begin, const ScriptRegexP& in_context) {
     if (!in_context) {
@@ -53,12 +57,57 @@ public:
   using Regex::matches;
 };
 
+// ----------------------------------------------------------------------------- : Regex cache
+
+/// The most recently used regular expressions
+/** Patterns that are built by a script can't be compiled in advance by SCRIPT_FUNCTION_SIMPLIFY_CLOSURE,
+ *  with this cache they are at least not compiled again on every call.
+ *  The cache is shared by all threads, this is safe because a ScriptRegex is not modified after it is compiled.
+ */
+class RegexCache {
+public:
+  /// Get a compiled regex for the given pattern
+  ScriptRegexP get(const String& code);
+private:
+  static const size_t MAX_SIZE = 256;
+  typedef list<pair<String,ScriptRegexP>> Entries;
+  Entries                         entries; ///< Most recently used first
+  map<String, Entries::iterator>  index;
+  mutex                           lock;
+};
+
+ScriptRegexP RegexCache::get(const String& code) {
+  {
+    lock_guard<mutex> guard(lock);
+    auto it = index.find(code);
+    if (it != index.end()) {
+      entries.splice(entries.begin(), entries, it->second);
+      return it->second->second;
+    }
+  }
+  // compile without holding the lock, this can take a while, or throw for invalid patterns
+  ScriptRegexP regex = make_intrusive<ScriptRegex>(code);
+  lock_guard<mutex> guard(lock);
+  auto it = index.find(code);
+  if (it != index.end()) {
+    return it->second->second; // another thread was first
+  }
+  entries.emplace_front(code, regex);
+  index.emplace(code, entries.begin());
+  if (entries.size() > MAX_SIZE) {
+    index.erase(entries.back().first);
+    entries.pop_back();
+  }
+  return regex;
+}
+
+RegexCache regex_cache;
+
 ScriptRegexP regex_from_script(const ScriptValueP& value) {
   // is it a regex already?
   ScriptRegexP regex = dynamic_pointer_cast<ScriptRegex>(value);
   if (!regex) {
-    // TODO: introduce some kind of caching?
-    regex = make_intrusive<ScriptRegex>(value->toString());
+    regex = regex_cache.get(value->toString());
   }
   return regex;
 }
@@ -149,6 +198,145 @@ SCRIPT_FUNCTION_SIMPLIFY_CLOSURE(replace_text) {
   return ScriptValueP();
 }
 
+// ----------------------------------------------------------------------------- : Rules : chains of literal replacements
+
+/// Replacing a literal string by another literal string
+struct LiteralReplacement {
+  String match;
+  String replacement;
+};
+
+/// Is a regular expression just a literal string? If so, store that string in literal
+static bool regex_literal(const String& code, String& literal) {
+  static const String special = _("\\^$.|?*+()[]{}");
+  literal.clear();
+  for (String::const_iterator it = code.begin() ; it != code.end() ; ++it) {
+    if (*it == _('\\')) {
+      // escaped special characters stand for themselves, other escapes are character classes, anchors, etc.
+      ++it;
+      if (it == code.end() || special.find(*it) == String::npos) return false;
+    } else if (special.find(*it) != String::npos) {
+      return false;
+    }
+    literal += *it;
+  }
+  return !literal.empty();
+}
+
+/// Is fun a replace_text closure that replaces a literal string by a literal string, without other parameters?
+static bool literal_replacement(const ScriptValueP& fun, LiteralReplacement& out) {
+  ScriptClosure* closure = dynamic_cast<ScriptClosure*>(fun.get());
+  if (!closure || closure->fun != script_replace_text || closure->bindings.size() != 2) return false;
+  ScriptValueP match   = closure->getBinding(SCRIPT_VAR_match);
+  ScriptValueP replace = closure->getBinding(SCRIPT_VAR_replace);
+  if (!match || !replace || replace->type() == SCRIPT_FUNCTION) return false;
+  ScriptRegex* regex = dynamic_cast<ScriptRegex*>(match.get());
+  if (!regex_literal(regex ? regex->code : match->toString(), out.match)) return false;
+  // in the replacement, & and \ refer to (parts of) the match
+  out.replacement = replace->toString();
+  return out.replacement.find_first_of(_("&\\")) == String::npos;
+}
+
+/// A composition of replace_text closures with literal patterns, that is done in a single pass
+/** This is only possible if the replacements can't see each other's effects:
+ *  no two patterns have a character in common, a pattern has no character in common with the replacement
+ *  of an earlier step, and if an earlier step removes its match, later patterns are single characters,
+ *  so they can't match text that has become adjacent.
+ *  Then all patterns can be matched in the original text at once, and each position has at most one candidate.
+ */
+class ScriptReplaceChain : public ScriptValue {
+public:
+  ScriptType type() const override { return SCRIPT_FUNCTION; }
+  String typeName() const override { return _("function composition"); }
+  ScriptValueP eval(Context& ctx, bool openScope) const override;
+  ScriptValueP dependencies(Context& ctx, const Dependency& dep) const override;
+  
+  /// Add a step to the end of the chain, returns false if it can't be done in the same pass
+  bool add(const ScriptValueP& step, const LiteralReplacement& replacement);
+  
+  vector<ScriptValueP>       steps;        ///< The composed functions
+  vector<LiteralReplacement> replacements; ///< What each of the steps does
+private:
+  map<Char,size_t>           first_chars;  ///< Which replacement has a pattern starting with a character
+  
+  String apply(const String& input) const;
+};
+
+bool ScriptReplaceChain::add(const ScriptValueP& step, const LiteralReplacement& replacement) {
+  FOR_EACH_CONST(earlier, replacements) {
+    FOR_EACH_CONST(c, replacement.match) {
+      if (earlier.match.find(c) != String::npos || earlier.replacement.find(c) != String::npos) return false;
+    }
+    if (earlier.replacement.empty() && replacement.match.size() > 1) return false;
+  }
+  first_chars[replacement.match[0]] = replacements.size();
+  steps.push_back(step);
+  replacements.push_back(replacement);
+  return true;
+}
+
+String ScriptReplaceChain::apply(const String& input) const {
+  String ret;
+  String::const_iterator done = input.begin(); // text before this position is in ret
+  String::const_iterator it   = input.begin();
+  while (it != input.end()) {
+    auto first = first_chars.find(*it);
+    if (first != first_chars.end() && is_substr(it, input.end(), replacements[first->second].match)) {
+      const LiteralReplacement& r = replacements[first->second];
+      ret.append(done, it);
+      ret += r.replacement;
+      it += r.match.size();
+      done = it;
+    } else {
+      ++it;
+    }
+  }
+  ret.append(done, input.end());
+  return ret;
+}
+
+ScriptValueP ScriptReplaceChain::eval(Context& ctx, bool openScope) const {
+  // arguments of the call override the bindings of the last closure, and replace_text looks for in_context and recursive in all scopes
+  if (ctx.getVariableScope(SCRIPT_VAR_match) != 0 && ctx.getVariableScope(SCRIPT_VAR_replace) != 0 &&
+      !ctx.getVariableOpt(SCRIPT_VAR_in_context) && !ctx.getVariableOpt(SCRIPT_VAR_recursive)) {
+    SCRIPT_PARAM_C(String, input);
+    SCRIPT_RETURN(apply(input));
+  }
+  // otherwise evaluate the steps one by one, like ScriptCompose
+  for (size_t i = 0 ; i + 1 < steps.size() ; ++i) {
+    ctx.setVariable(SCRIPT_VAR_input, steps[i]->eval(ctx));
+  }
+  return steps.back()->eval(ctx, openScope);
+}
+
+ScriptValueP ScriptReplaceChain::dependencies(Context& ctx, const Dependency& dep) const {
+  for (size_t i = 0 ; i + 1 < steps.size() ; ++i) {
+    ctx.setVariable(SCRIPT_VAR_input, steps[i]->dependencies(ctx, dep));
+  }
+  return steps.back()->dependencies(ctx, dep);
+}
+
+/// Add the steps of a function to a chain, returns false if that is not possible
+static bool add_to_chain(ScriptReplaceChain& chain, const ScriptValueP& fun) {
+  if (ScriptReplaceChain* other = dynamic_cast<ScriptReplaceChain*>(fun.get())) {
+    for (size_t i = 0 ; i < other->steps.size() ; ++i) {
+      if (!chain.add(other->steps[i], other->replacements[i])) return false;
+    }
+    return true;
+  }
+  LiteralReplacement replacement;
+  return literal_replacement(fun, replacement) && chain.add(fun, replacement);
+}
+
+ScriptValueP fuse_replace_functions(const ScriptValueP& a, const ScriptValueP& b) {
+  intrusive_ptr<ScriptReplaceChain> chain = make_intrusive<ScriptReplaceChain>();
+  if (add_to_chain(*chain, a) && add_to_chain(*chain, b)) {
+    return chain;
+  } else {
+    return ScriptValueP();
+  }
+}
+
 // ----------------------------------------------------------------------------- : Rules : regex filter
 
 SCRIPT_FUNCTION_WITH_SIMPLIFY(filter_text) {
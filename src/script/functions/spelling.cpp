@@ -16,9 +16,10 @@
 
 // ----------------------------------------------------------------------------- : Functions
 
-inline size_t spelled_correctly(const String& input, size_t start, size_t end, SpellChecker** checkers, const ScriptValueP& extra_test, Context& ctx) {
+inline size_t spelled_correctly(const String& input, size_t start, size_t end, const SpellCheckerP* checkers, const ScriptValueP& extra_test, Context& ctx) {
   // untag
-  String word = untag(input.substr(start,end-start));
+  String tagged = input.substr(start,end-start);
+  String word = untag(tagged);
   if (word.empty()) return true;
   // run through spellchecker(s)
   for (size_t i = 0 ; checkers[i] ; ++i) {
@@ -33,8 +34,9 @@ inline size_t spelled_correctly(const String& input, size_t start, size_t end, S
     if (extra_test->eval(ctx)->toBool()) {
       return true;
     }
-    // try on tagged
-    ctx.setVariable(SCRIPT_VAR_input, to_script(input.substr(start,end-start)));
+    // try on tagged, unless that is the same as what we just tried
+    if (tagged == word) return false;
+    ctx.setVariable(SCRIPT_VAR_input, to_script(tagged));
     if (extra_test->eval(ctx)->toBool()) {
       return true;
     }
@@ -42,7 +44,7 @@ inline size_t spelled_correctly(const String& input, size_t start, size_t end, S
   return false;
 }
 
-void check_word(const String& tag, const String& input, size_t start, size_t end, String& out, bool check, SpellChecker** checkers, const ScriptValueP& extra_test, Context& ctx) {
+void check_word(const String& tag, const String& input, size_t start, size_t end, String& out, bool check, const SpellCheckerP* checkers, const ScriptValueP& extra_test, Context& ctx) {
   if (start >= end) return;
   bool good = !check || spelled_correctly(input, start, end, checkers, extra_test, ctx);
   if (!good) { out += _("<"); out += tag; }
@@ -69,7 +71,7 @@ SCRIPT_FUNCTION(check_spelling) {
   if (language.empty()) {
     SCRIPT_RETURN(input);
   }
-  SpellChecker* checkers[3] = {nullptr};
+  SpellCheckerP checkers[3];
   checkers[0] = SpellChecker::get(language);
   if (!extra_dictionary.empty()) {
     checkers[1] = SpellChecker::get(extra_dictionary,language);
@@ -25,7 +25,7 @@ Image ScriptableImage::generate(const GeneratedImage::Options& options) const {
     //       We could return a blank one, but the thumbnail code does want an invalid
     //       image in case of errors.
     //       This allows the caller to catch errors.
-    image = value->generate(options);
+    image = value->generateCached(options);
   } else {
     // error, return blank image
     Image i(1,1);
@@ -396,6 +396,12 @@ ExprType parseOper(TokenIterator& input, Script& script, Precedence min_prec, In
 /// Parse call arguments, "(...)"
 void parseCallArguments(TokenIterator& input, Script& script, vector<Variable>& arguments);
 
+/// Turn a closure that is called right away, f@(a:x)(b:y), into a single call f(a:x,b:y)
+/** closure is the position of the I_CLOSURE instruction, arguments are those of the call.
+ *  Returns false if an argument is given to both, then the closure is needed for its default value.
+ */
+bool inlineClosure(Script& script, size_t closure, vector<Variable>& arguments);
+
 ExprType parseTopLevel(TokenIterator& input, Script& script) {
   ExprType type = parseOper(input, script, PREC_ALL);
   Token eof = input.read();
@@ -416,6 +422,8 @@ ScriptP parse(const String& s, Packaged* package, bool string_mode, vector<Scrip
   if (type == EXPR_FAILED) {
     return ScriptP();
   } else {
+    script->optimize();
+    script->fuseInstructions();
     return script;
   }
 }
@@ -456,6 +464,8 @@ ExprType parseExpr(TokenIterator& input, Script& script, Precedence minPrec) {
       input.add_error(_("Warning: last statement of a function should be an expression, that is, it should return a result in all cases."));
     }
     expectToken(input, _("}"), &token);
+    subScript->optimize();
+    subScript->fuseInstructions();
     script.addInstruction(I_PUSH_CONST, subScript);
   } else if (token == _("[")) {
     // [] = list or map literal
@@ -717,10 +727,14 @@ ExprType parseExpr(TokenIterator& input, Script& script, Precedence minPrec) {
 
 ExprType parseOper(TokenIterator& input, Script& script, Precedence minPrec, InstructionType closeWith, int closeWithData) {
   ExprType type = parseExpr(input, script, minPrec); // first argument
+  // position of the I_CLOSURE instruction, if the last operator was "@(...)"
+  size_t closure = INVALID_ADDRESS;
   // read any operators after an expression
   // EBNF:                    expr = expr | expr oper expr
   // without left recursion:  expr = expr (oper expr)*
   while (true) {
+    size_t last_closure = closure;
+    closure = INVALID_ADDRESS;
     Token token = input.read();
     if (token != TOK_OPER && token != TOK_NAME && token!=TOK_LPAREN &&
         !((token == TOK_STRING || token == TOK_INT || token == TOK_DOUBLE) && minPrec <= PREC_NEWLINE && token.newline)) {
@@ -823,6 +837,10 @@ ExprType parseOper(TokenIterator& input, Script& script, Precedence minPrec, Ins
       vector<Variable> arguments;
       parseCallArguments(input, script, arguments);
       expectToken(input, _(")"), &token);
+      // optimize: no closure object is needed if it is called right away
+      if (last_closure != INVALID_ADDRESS) {
+        inlineClosure(script, last_closure, arguments);
+      }
       // generate instruction
       script.addInstruction(I_CALL, (unsigned int)arguments.size());
       FOR_EACH(arg,arguments) {
@@ -835,6 +853,7 @@ ExprType parseOper(TokenIterator& input, Script& script, Precedence minPrec, Ins
       parseCallArguments(input, script, arguments);
       expectToken(input, _(")"), &token);
       // generate instruction
+      closure = script.getInstructions().size();
       script.addInstruction(I_CLOSURE, (unsigned int)arguments.size());
       FOR_EACH(arg,arguments) {
         script.addInstruction(I_NOP, arg);
@@ -900,3 +919,37 @@ void parseCallArguments(TokenIterator& input, Script& script, vector<Variable>&
     }
   }
 }
+
+bool inlineClosure(Script& script, size_t closure, vector<Variable>& arguments) {
+  vector<Instruction>& instrs = script.getInstructions();
+  unsigned int n = instrs[closure].data;
+  // the arguments of the closure come first on the stack, so their names come first in the call
+  vector<Variable> closure_arguments;
+  for (size_t j = 1 ; j <= n ; ++j) {
+    closure_arguments.push_back((Variable)instrs[closure + j].data);
+  }
+  FOR_EACH_CONST(arg, arguments) {
+    if (find(closure_arguments.begin(), closure_arguments.end(), arg) != closure_arguments.end()) {
+      return false;
+    }
+  }
+  // remove the closure instruction and its argument names
+  instrs.erase(instrs.begin() + closure, instrs.begin() + closure + n + 1);
+  // jumps in the call arguments now have to go to an earlier position
+  for (size_t pos = closure ; pos < instrs.size() ; ++pos) {
+    Instruction& i = instrs[pos];
+    switch (i.instr) {
+      case I_JUMP: case I_JUMP_IF_NOT: case I_JUMP_SC_AND: case I_JUMP_SC_OR:
+      case I_LOOP: case I_LOOP_WITH_KEY:
+        if (i.data != INVALID_ADDRESS && i.data > closure) i.data -= n + 1;
+        break;
+      case I_CALL: case I_TAILCALL: case I_CLOSURE:
+        pos += i.data; // skip argument names
+        break;
+      default:
+        break;
+    }
+  }
+  arguments.insert(arguments.begin(), closure_arguments.begin(), closure_arguments.end());
+  return true;
+}
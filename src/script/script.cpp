@@ -10,24 +10,32 @@
 #include <script/script.hpp>
 #include <script/context.hpp>
 #include <script/to_value.hpp>
+#include <script/functions/functions.hpp>
 #include <util/error.hpp>
+#include <shared_mutex>
 
 // ----------------------------------------------------------------------------- : Variables
 
 typedef map<String, Variable> Variables;
 Variables variables;
-#ifdef _DEBUG
-  vector<String> variable_names;
-#endif
+vector<String> variable_names; ///< Names of the variables, indexed by Variable
+/// Scripts are evaluated from multiple threads, this protects the variables map
+shared_mutex variables_mutex;
 
 /// Return a unique name for a variable to allow for faster loopups
 Variable string_to_variable(const String& s) {
+  {
+    shared_lock<shared_mutex> lock(variables_mutex);
+    Variables::const_iterator it = variables.find(s);
+    if (it != variables.end()) return it->second;
+  }
+  lock_guard<shared_mutex> lock(variables_mutex);
   Variables::iterator it = variables.find(s);
   if (it == variables.end()) {
     #ifdef _DEBUG
-      variable_names.push_back(s);
       assert(s == canonical_name_form(s)); // only use canonical names
     #endif
+    variable_names.push_back(s);
     Variable v = (Variable)variables.size();
     variables.insert(make_pair(s,v));
     return v;
@@ -37,12 +45,9 @@ Variable string_to_variable(const String& s) {
 }
 
 /// Get the name of a vaiable
-/** Warning: this function is slow, it should only be used for error messages and such.
- */
 String variable_to_string(Variable v) {
-  FOR_EACH(vi, variables) {
-    if (vi.second == v) return replace_all(vi.first, _(" "), _("_"));
-  }
+  shared_lock<shared_mutex> lock(variables_mutex);
+  if ((size_t)v < variable_names.size()) return replace_all(variable_names[v], _(" "), _("_"));
   throw InternalError(String(_("Variable not found: ")) << v);
 }
 
@@ -95,8 +100,6 @@ ScriptValueP Script::dependencies(Context& ctx, const Dependency& dep) const {
   return ctx.dependencies(dep, *this);
 }
 
-static const unsigned int INVALID_ADDRESS = 0x03FFFFFF;
-
 Addr Script::addInstruction(InstructionType t) {
   assert( t == I_JUMP
        || t == I_JUMP_IF_NOT
@@ -150,6 +153,378 @@ Addr Script::getLabel() const {
   return Addr{ (unsigned int)instructions.size() };
 }
 
+// ----------------------------------------------------------------------------- : Optimization
+
+void Script::optimize() {
+  // folding can make code unreachable, and removing code can bring more constants together
+  while (true) {
+    bool folded  = foldConstants();
+    bool removed = removeDeadCode();
+    if (!folded && !removed) break;
+  }
+  removeUnusedConstants();
+}
+
+vector<bool> Script::jumpTargets() const {
+  vector<bool> is_target(instructions.size() + 1, false);
+  for (size_t pos = 0 ; pos < instructions.size() ; ++pos) {
+    const Instruction& i = instructions[pos];
+    switch (i.instr) {
+      case I_JUMP: case I_JUMP_IF_NOT: case I_JUMP_SC_AND: case I_JUMP_SC_OR:
+      case I_LOOP: case I_LOOP_WITH_KEY: case I_CALL_FOLDED:
+        if (i.data < is_target.size()) is_target[i.data] = true;
+        break;
+      case I_CALL: case I_TAILCALL: case I_CLOSURE:
+        pos += i.data; // skip argument names
+        break;
+      default:
+        break;
+    }
+  }
+  return is_target;
+}
+
+/// Is a value simple enough to be computed with when the script is parsed?
+/** Functions and collections are excluded, they can depend on the context or be modified.
+ */
+static bool is_simple_constant(const ScriptValue& value) {
+  switch (value.type()) {
+    case SCRIPT_NIL: case SCRIPT_INT: case SCRIPT_BOOL: case SCRIPT_DOUBLE:
+    case SCRIPT_STRING: case SCRIPT_COLOR:
+      return true;
+    default:
+      return false;
+  }
+}
+
+/// Can a binary instruction on constants be evaluated when the script is parsed?
+static bool is_foldable(BinaryInstructionType i) {
+  return i != I_ITERATOR_R && i != I_MEMBER && i != I_OR_ELSE;
+}
+
+/// Would an integer division on these constants trap?
+/** That is not an Error that eval_constant can catch, so the division is left to run time, where it might never happen.
+ */
+static bool division_traps(BinaryInstructionType i, const ScriptValueP& a, const ScriptValueP& b) {
+  if (i != I_DIV && i != I_MOD) return false;
+  if (a->type() == SCRIPT_DOUBLE || b->type() == SCRIPT_DOUBLE) return false;
+  try {
+    int bi = b->toInt();
+    return bi == 0 || (bi == -1 && a->toInt() == numeric_limits<int>::min());
+  } catch (const Error&) {
+    return false; // the conversion fails, eval_constant leaves that to run time
+  }
+}
+
+/// Evaluate count instructions with the given values on the stack
+/** Returns nullptr if that fails or doesn't give a simple constant, the error is then left for run time.
+ */
+static ScriptValueP eval_constant(const vector<ScriptValueP>& values, const Instruction* instr, size_t count) {
+  Script code;
+  FOR_EACH_CONST(v, values) {
+    code.addInstruction(I_PUSH_CONST, v);
+  }
+  code.getInstructions().insert(code.getInstructions().end(), instr, instr + count);
+  try {
+    Context ctx;
+    ScriptValueP result = ctx.eval(code);
+    if (result && is_simple_constant(*result)) return result;
+  } catch (const Error&) {
+    // leave it to run time
+  }
+  return ScriptValueP();
+}
+
+bool Script::foldConstants() {
+  vector<bool> is_target = jumpTargets();
+  // calls to variables that are assigned to in this script can't be folded
+  set<unsigned int> assigned;
+  FOR_EACH_CONST(i, instructions) {
+    if (i.instr == I_SET_VAR) assigned.insert(i.data);
+  }
+  // build the new instructions, jumps keep the old addresses until the end
+  vector<Instruction> out;
+  vector<bool> out_is_target;
+  vector<unsigned int> new_pos(instructions.size() + 1, 0);
+  bool changed = false;
+  // can the last n instructions be merged, i.e. are none of them jumped to, except for the first?
+  auto can_merge = [&](size_t n) {
+    if (out.size() < n) return false;
+    for (size_t j = out.size() - n + 1 ; j < out.size() ; ++j) {
+      if (out_is_target[j]) return false;
+    }
+    return true;
+  };
+  // are the last n instructions pushes of simple constants? store them in values
+  auto constant_tail = [&](size_t n, vector<ScriptValueP>& values) {
+    if (out.size() < n) return false;
+    for (size_t j = out.size() - n ; j < out.size() ; ++j) {
+      if (out[j].instr != I_PUSH_CONST || !is_simple_constant(*constants[out[j].data])) return false;
+      values.push_back(constants[out[j].data]);
+    }
+    return true;
+  };
+  // replace the last n instructions by a single constant
+  auto replace_tail = [&](size_t n, const ScriptValueP& value) {
+    out.resize(out.size() - n + 1);
+    out_is_target.resize(out.size());
+    constants.push_back(value);
+    out.back() = Instruction{I_PUSH_CONST, {(unsigned int)constants.size() - 1}};
+    changed = true;
+  };
+  
+  for (size_t pos = 0 ; pos < instructions.size() ; ++pos) {
+    const Instruction& i = instructions[pos];
+    new_pos[pos] = (unsigned int)out.size();
+    if (!is_target[pos]) {
+      // operators on constants
+      size_t n = 0;
+      if      (i.instr == I_UNARY)      n = i.instr1 != I_ITERATOR_C ? 1 : 0;
+      else if (i.instr == I_BINARY)     n = is_foldable(i.instr2)    ? 2 : 0;
+      else if (i.instr == I_TERNARY)    n = 3;
+      else if (i.instr == I_QUATERNARY) n = 4;
+      vector<ScriptValueP> values;
+      if (n && can_merge(n) && constant_tail(n, values)
+            && !(i.instr == I_BINARY && division_traps(i.instr2, values[0], values[1]))) {
+        ScriptValueP result = eval_constant(values, &i, 1);
+        if (result) {
+          replace_tail(n, result);
+          continue;
+        }
+      }
+      // calls to pure built in functions with constant arguments
+      // the name of the function can be bound to something else when the script is run,
+      // so the call is kept, and I_CALL_FOLDED checks the function before using the result
+      if (i.instr == I_CALL && pos + i.data < instructions.size()) {
+        n = i.data;
+        values.clear();
+        bool folded_before = out.size() >= n + 3 && out[out.size() - n - 3].instr == I_CALL_FOLDED;
+        if (!folded_before && can_merge(n + 1) && out[out.size() - n - 1].instr == I_GET_VAR
+            && !assigned.count(out[out.size() - n - 1].data) && constant_tail(n, values)) {
+          vector<Variable> arguments;
+          for (size_t j = 1 ; j <= n ; ++j) arguments.push_back((Variable)instructions[pos + j].data);
+          ScriptValueP fun = pure_script_function((Variable)out[out.size() - n - 1].data, arguments);
+          if (fun) {
+            values.insert(values.begin(), fun);
+            ScriptValueP result = eval_constant(values, &i, n + 1);
+            if (result) {
+              // I_CALL_FOLDED jumps to after the argument names, jumps use old addresses until the end
+              constants.push_back(result);
+              size_t at = out.size() - n - 1;
+              out.insert(out.begin() + at, {Instruction{I_CALL_FOLDED, {(unsigned int)(pos + n + 1)}},
+                                            Instruction{I_PUSH_CONST, {(unsigned int)constants.size() - 1}}});
+              out_is_target.insert(out_is_target.begin() + at, 2, false);
+              new_pos[pos] = (unsigned int)out.size();
+              changed = true;
+            }
+          }
+        }
+      }
+      // control flow on constants
+      values.clear();
+      if (constant_tail(1, values)) {
+        ScriptType type = values[0]->type();
+        if (i.instr == I_POP) {
+          // push x; pop  -->  nothing
+          out.pop_back();
+          out_is_target.pop_back();
+          changed = true;
+          continue;
+        } else if (type == SCRIPT_BOOL && (i.instr == I_JUMP_IF_NOT || i.instr == I_JUMP_SC_AND || i.instr == I_JUMP_SC_OR)) {
+          bool jump = values[0]->toBool() == (i.instr == I_JUMP_SC_OR);
+          if (!jump) {
+            // the condition is popped, and we fall through
+            out.pop_back();
+            out_is_target.pop_back();
+          } else if (i.instr == I_JUMP_IF_NOT) {
+            // the condition is popped, and we always jump
+            out.back() = Instruction{I_JUMP, {i.data}};
+          } else {
+            // the condition stays on the stack, and we always jump
+            out.push_back(Instruction{I_JUMP, {i.data}});
+            out_is_target.push_back(false);
+          }
+          changed = true;
+          continue;
+        }
+      }
+    }
+    // keep the instruction
+    out.push_back(i);
+    out_is_target.push_back(is_target[pos]);
+    if (i.instr == I_CALL || i.instr == I_TAILCALL || i.instr == I_CLOSURE) {
+      // and its argument names
+      for (size_t j = 0 ; j < i.data && pos + 1 < instructions.size() ; ++j) {
+        out.push_back(instructions[++pos]);
+        out_is_target.push_back(false);
+      }
+    }
+  }
+  if (!changed) return false;
+  // update jumps
+  new_pos[instructions.size()] = (unsigned int)out.size();
+  FOR_EACH(i, out) {
+    switch (i.instr) {
+      case I_JUMP: case I_JUMP_IF_NOT: case I_JUMP_SC_AND: case I_JUMP_SC_OR:
+      case I_LOOP: case I_LOOP_WITH_KEY: case I_CALL_FOLDED:
+        i.data = new_pos[i.data];
+        break;
+      default:
+        break;
+    }
+  }
+  instructions.swap(out);
+  return true;
+}
+
+bool Script::removeDeadCode() {
+  // find reachable instructions
+  vector<bool> keep(instructions.size(), false);
+  vector<size_t> todo(1, 0);
+  while (!todo.empty()) {
+    size_t pos = todo.back();
+    todo.pop_back();
+    while (pos < instructions.size() && !keep[pos]) {
+      keep[pos] = true;
+      const Instruction& i = instructions[pos];
+      switch (i.instr) {
+        case I_JUMP:
+          pos = i.data;
+          break;
+        case I_JUMP_IF_NOT: case I_JUMP_SC_AND: case I_JUMP_SC_OR:
+        case I_LOOP: case I_LOOP_WITH_KEY: case I_CALL_FOLDED:
+          todo.push_back(i.data);
+          pos += 1;
+          break;
+        case I_CALL: case I_TAILCALL: case I_CLOSURE:
+          // argument names
+          for (size_t j = 1 ; j <= i.data && pos + j < instructions.size() ; ++j) keep[pos + j] = true;
+          pos += i.data + 1;
+          break;
+        default:
+          pos += 1;
+          break;
+      }
+    }
+  }
+  // jumps over unreachable code are not needed
+  for (size_t pos = 0 ; pos < instructions.size() ; ++pos) {
+    const Instruction& i = instructions[pos];
+    if (!keep[pos] || i.instr != I_JUMP || i.data <= pos) continue;
+    size_t skipped = pos + 1;
+    while (skipped < i.data && skipped < instructions.size() && !keep[skipped]) ++skipped;
+    if (skipped == i.data) keep[pos] = false;
+  }
+  if (find(keep.begin(), keep.end(), false) == keep.end()) return false;
+  // new positions, removed instructions are replaced by the next instruction that is kept
+  vector<unsigned int> new_pos(instructions.size() + 1);
+  unsigned int count = 0;
+  for (size_t pos = 0 ; pos < instructions.size() ; ++pos) {
+    new_pos[pos] = count;
+    if (keep[pos]) ++count;
+  }
+  new_pos[instructions.size()] = count;
+  // remove
+  vector<Instruction> out;
+  out.reserve(count);
+  for (size_t pos = 0 ; pos < instructions.size() ; ++pos) {
+    if (!keep[pos]) continue;
+    Instruction i = instructions[pos];
+    switch (i.instr) {
+      case I_JUMP: case I_JUMP_IF_NOT: case I_JUMP_SC_AND: case I_JUMP_SC_OR:
+      case I_LOOP: case I_LOOP_WITH_KEY: case I_CALL_FOLDED:
+        i.data = new_pos[i.data];
+        break;
+      default:
+        break;
+    }
+    out.push_back(i);
+  }
+  instructions.swap(out);
+  return true;
+}
+
+void Script::removeUnusedConstants() {
+  vector<unsigned int> new_index(constants.size(), INVALID_ADDRESS);
+  vector<ScriptValueP> used;
+  for (size_t pos = 0 ; pos < instructions.size() ; ++pos) {
+    Instruction& i = instructions[pos];
+    switch (i.instr) {
+      case I_PUSH_CONST: case I_MEMBER_C: case I_PUSH_CONST_BINARY:
+        if (new_index[i.data] == INVALID_ADDRESS) {
+          new_index[i.data] = (unsigned int)used.size();
+          used.push_back(constants[i.data]);
+        }
+        i.data = new_index[i.data];
+        break;
+      case I_CALL: case I_TAILCALL: case I_CLOSURE:
+        pos += i.data; // skip argument names
+        break;
+      default:
+        break;
+    }
+  }
+  constants.swap(used);
+}
+
+// ----------------------------------------------------------------------------- : Superinstructions
+
+void Script::fuseInstructions() {
+  // we can't fuse an instruction with one that is jumped to
+  vector<bool> is_target = jumpTargets();
+  auto can_fuse = [&](size_t pos, InstructionType next) {
+    return pos + 1 < instructions.size() && !is_target[pos + 1] && instructions[pos + 1].instr == next;
+  };
+  // fuse pairs
+  for (size_t pos = 0 ; pos + 1 < instructions.size() ; ++pos) {
+    Instruction& i = instructions[pos];
+    switch (i.instr) {
+      case I_GET_VAR:
+        if (can_fuse(pos, I_MEMBER_C)) i.instr = I_GET_VAR_MEMBER_C;
+        break;
+      case I_PUSH_CONST:
+        // prefer fusing the binary instruction with a following jump
+        if (can_fuse(pos, I_BINARY) && instructions[pos + 1].instr2 != I_MEMBER && !can_fuse(pos + 1, I_JUMP_IF_NOT)) {
+          i.instr = I_PUSH_CONST_BINARY;
+        }
+        break;
+      case I_BINARY:
+        // member lookups are left to I_BINARY, which records them for Context::evalCached
+        if (can_fuse(pos, I_JUMP_IF_NOT) && i.instr2 != I_MEMBER) i.instr = I_BINARY_JUMP_IF_NOT;
+        break;
+      case I_CALL: case I_TAILCALL: case I_CLOSURE:
+        pos += i.data; // skip argument names
+        break;
+      default:
+        break;
+    }
+  }
+  internMemberNames();
+}
+
+void Script::internMemberNames() {
+  member_caches = vector<MemberCache>(constants.size());
+  folded_functions = vector<ScriptValueP>(constants.size());
+  for (size_t pos = 0 ; pos < instructions.size() ; ++pos) {
+    const Instruction& i = instructions[pos];
+    if (i.instr == I_MEMBER_C) {
+      member_caches[i.data].name = constants[i.data]->toString();
+    } else if (i.instr == I_CALL_FOLDED && pos + 2 < instructions.size()) {
+      // find the call: push result; get f; push arguments; call
+      size_t call = pos + 3;
+      while (call < instructions.size() && instructions[call].instr == I_PUSH_CONST) ++call;
+      if (call >= instructions.size() || instructions[call].instr != I_CALL) continue;
+      vector<Variable> arguments;
+      for (size_t j = 1 ; j <= instructions[call].data && call + j < instructions.size() ; ++j) {
+        arguments.push_back((Variable)instructions[call + j].data);
+      }
+      folded_functions[instructions[pos + 1].data] = pure_script_function((Variable)instructions[pos + 2].data, arguments);
+    } else if (i.instr == I_CALL || i.instr == I_TAILCALL || i.instr == I_CLOSURE) {
+      pos += i.data; // skip argument names
+    }
+  }
+}
+
 #ifdef _DEBUG // debugging
 
 String Script::dumpScript() const {
@@ -187,7 +562,8 @@ String Script::dumpInstr(unsigned int pos, Instruction i) const {
         case I_NOT:      ret += _("not");    break;
       }
       break;
-    case I_BINARY:    ret += _("binary\t");
+    case I_BINARY: case I_BINARY_JUMP_IF_NOT:
+      ret += i.instr == I_BINARY ? _("binary\t") : _("binary+jnz\t");
       switch (i.instr2) {
         case I_ITERATOR_R:  ret += _("iterator_r");  break;
         case I_MEMBER:    ret += _("member");    break;
@@ -221,20 +597,23 @@ String Script::dumpInstr(unsigned int pos, Instruction i) const {
     case I_DUP:      ret += _("dup");        break;
     case I_POP:      ret += _("pop");        break;
     case I_TAILCALL:  ret += _("tailcall");      break;
+    case I_GET_VAR_MEMBER_C:  ret += _("get+member_c");  break;
+    case I_PUSH_CONST_BINARY: ret += _("push+binary");   break;
+    case I_CALL_FOLDED:       ret += _("call folded");   break;
   }
   // arg
   switch (i.instr) {
-    case I_PUSH_CONST: case I_MEMBER_C:              // const
+    case I_PUSH_CONST: case I_MEMBER_C: case I_PUSH_CONST_BINARY: // const
       ret += _("\t") + constants[i.data]->typeName();
       ret += _("\t") + constants[i.data]->toCode();
       break;
     case I_JUMP: case I_JUMP_IF_NOT: case I_JUMP_SC_AND: case I_JUMP_SC_OR:
-    case I_LOOP: case I_LOOP_WITH_KEY:
+    case I_LOOP: case I_LOOP_WITH_KEY: case I_CALL_FOLDED:
     case I_MAKE_OBJECT:
     case I_CALL: case I_CLOSURE: case I_DUP:  // int
       ret += String::Format(_("\t%d"), i.data);
       break;
-    case I_GET_VAR: case I_SET_VAR: case I_NOP:          // variable
+    case I_GET_VAR: case I_SET_VAR: case I_NOP: case I_GET_VAR_MEMBER_C: // variable
       ret += _("\t") + variable_to_string((Variable)i.data);
       break;
   }
@@ -257,11 +636,13 @@ const Instruction* Script::backtraceSkip(const Instruction* instr, int to_skip)
            )
          ) ; --instr) {
     // skip an instruction
+    // superinstructions are treated as their first half, the second half is still there
     switch (instr->instr) {
-      case I_PUSH_CONST:
-      case I_GET_VAR: case I_DUP:
+      case I_PUSH_CONST: case I_PUSH_CONST_BINARY:
+      case I_GET_VAR: case I_GET_VAR_MEMBER_C: case I_DUP:
         to_skip -= 1; break; // nett stack effect +1
-      case I_BINARY:
+      case I_BINARY: case I_BINARY_JUMP_IF_NOT:
+      case I_CALL_FOLDED: // undoes the I_PUSH_CONST after it, that is skipped when the call is made
         to_skip += 1; break; // nett stack effect 1-2 == -1
       case I_TERNARY:
         to_skip += 2; break; // nett stack effect 1-3 == -2
@@ -332,7 +713,7 @@ const Instruction* Script::backtraceSkip(const Instruction* instr, int to_skip)
 
 String Script::instructionName(const Instruction* instr) const {
   if (instr < &instructions[0] || instr >= &instructions[0] + instructions.size()) return _("??\?");
-  if (instr->instr == I_GET_VAR) {
+  if (instr->instr == I_GET_VAR || instr->instr == I_GET_VAR_MEMBER_C) {
     return variable_to_string((Variable)instr->data);
   } else if (instr->instr == I_MEMBER_C) {
     return instructionName(backtraceSkip(instr - 1, 0))
@@ -10,6 +10,8 @@
 
 #include <util/prec.hpp>
 #include <script/value.hpp>
+#include <deque>
+#include <mutex>
 
 DECLARE_POINTER_TYPE(Script);
 
@@ -47,6 +49,15 @@ enum InstructionType
 ,  I_QUATERNARY    = 16 ///< arg = 4ary instr : pop 4 values, apply a function, push the result
 ,  I_DUP           = 17 ///< arg = int        : duplicate the k-from-top element of the stack
 ,  I_POP           = 18 ///< arg = *          : pop the top value off the stack.
+  // Superinstructions, see Script::fuseInstructions
+  // these perform the instruction and the one after it, which is left in place unchanged
+,  I_GET_VAR_MEMBER_C   = 21 ///< arg = var       : I_GET_VAR, followed by the next I_MEMBER_C
+,  I_PUSH_CONST_BINARY  = 22 ///< arg = const val : I_PUSH_CONST, followed by the next I_BINARY
+,  I_BINARY_JUMP_IF_NOT = 23 ///< arg = 2ary instr: I_BINARY, followed by the next I_JUMP_IF_NOT
+  // Folded calls, see Script::foldConstants
+,  I_CALL_FOLDED   = 24 ///< arg = address    : followed by I_PUSH_CONST result, I_GET_VAR f, constant arguments, I_CALL.
+                        ///<                    if f is still the built in function the call was folded for,
+                        ///<                    push the result and jump to the address after the call, otherwise do the call.
 };
 
 /// Types of unary instructions (taking one argument from the stack)
@@ -115,6 +126,9 @@ struct Addr {
   unsigned int addr;
 };
 
+/// Jump target of a jump instruction that has not been resolved with comeFrom yet
+const unsigned int INVALID_ADDRESS = 0x03FFFFFF;
+
 // ----------------------------------------------------------------------------- : Variables
 
 // for faster lookup from code
@@ -153,13 +167,33 @@ enum Variable
 Variable string_to_variable(const String& s);
 
 /// Get the name of a vaiable
-/** Warning: this function is slow, it should only be used for error messages and such.
- */
 String variable_to_string(Variable v);
 
 /// initialze the script variables
 void init_script_variables();
 
+// ----------------------------------------------------------------------------- : ScriptMemo
+
+/// An earlier evaluation of a script, with the inputs it read, see Context::evalCached
+/** Inputs are stored as snapshots, since values like card fields change in place.
+ *  Objects are recorded by identity only, so a memo doesn't keep deleted cards or values alive.
+ *  The members are read again from the objects in the variables of the context that checks the memo,
+ *  never from objects seen by the thread that recorded it.
+ */
+struct ScriptMemo {
+  /// A member of an object that was read
+  struct MemberRead {
+    bool         of_member; ///< Was the object the result of an earlier member read? otherwise it was the value of a variable
+    size_t       source;    ///< Index of the read that gave the object, in members or variables
+    String       name;      ///< Name of the member
+    ScriptValueP value;     ///< Snapshot of the member
+  };
+  vector<pair<Variable,ScriptValueP>> variables; ///< Variables set outside the script that were read, with snapshots of their values
+  vector<MemberRead>                  members;   ///< Members of objects that were read, in order
+  bool         cacheable = true; ///< Does the result depend only on the recorded inputs?
+  ScriptValueP result;           ///< Result of the evaluation
+};
+
 
 // ----------------------------------------------------------------------------- : Script
 
@@ -193,6 +227,24 @@ public:
   /// Get the current instruction position
   Addr getLabel() const;
   
+  /// Simplify the script by evaluating everything that doesn't depend on variables
+  /** Folds operators, and calls of pure built-in functions with constant arguments (guarded by I_CALL_FOLDED),
+   *  resolves jumps on constant conditions and removes code that can not be reached.
+   *  Should be called when the script is complete, before fuseInstructions.
+   */
+  void optimize();
+  /// Combine common pairs of instructions into superinstructions
+  /** Should be called when the script is complete, i.e. when all jumps have been resolved.
+   *  The second instruction of a pair is kept, so dependency analysis and backtracing
+   *  can treat a superinstruction as the first instruction of the pair.
+   *  Also sets up the inline caches for member lookups, see internMemberNames.
+   */
+  void fuseInstructions();
+  /// Convert the names used by I_MEMBER_C to strings once, and make an inline cache for each
+  /** Also looks up the built in functions for I_CALL_FOLDED.
+   *  Called by fuseInstructions, and when loading a compiled script */
+  void internMemberNames();
+  
   /// Get access to the vector of instructions
   inline vector<Instruction>& getInstructions() { return instructions; }
   /// Get access to the vector of constants
@@ -211,6 +263,27 @@ private:
   /// Constant values that can be referred to from the script
   vector<ScriptValueP> constants;
   
+  /// Results of recent evaluations, most recent first, see Context::evalCached
+  mutable deque<ScriptMemo> memos;
+  /// Is it worth recording inputs? false if an evaluation depended on something that can't be recorded
+  mutable bool memoizable = true;
+  /// Mutex for memos and memoizable, a script can be evaluated in multiple threads
+  mutable mutex memos_mutex;
+  /// Inline caches for I_MEMBER_C, indexed by the constant holding the member name
+  /** Empty if the script was not finished with fuseInstructions */
+  mutable vector<MemberCache> member_caches;
+  /// Built in functions that calls were folded for, indexed by the constant holding the result, see I_CALL_FOLDED
+  vector<ScriptValueP> folded_functions;
+  
+  /// Find the positions that are the target of a jump, the result has one extra element for the end
+  vector<bool> jumpTargets() const;
+  /// Replace instructions on constant operands by their result, returns true if anything changed
+  bool foldConstants();
+  /// Remove unreachable instructions and jumps to the next instruction, returns true if anything changed
+  bool removeDeadCode();
+  /// Remove constants that are no longer used by any instruction
+  void removeUnusedConstants();
+  
   /// Do a backtrace for error messages.
   /** Starting from instr, move backwards until the nett stack effect
    *  of the skipped instructions is equal to_skip.
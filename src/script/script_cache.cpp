@@ -0,0 +1,352 @@
+//+----------------------------------------------------------------------------+
+//| Description:  Magic Set Editor - Program to make Magic (tm) cards          |
+//| Copyright:    (C) Twan van Laarhoven and the other MSE developers          |
+//| License:      GNU General Public License 2 or later (see file COPYING)     |
+//+----------------------------------------------------------------------------+
+
+// ----------------------------------------------------------------------------- : Includes
+
+#include <util/prec.hpp>
+#include <script/script_cache.hpp>
+#include <script/to_value.hpp>
+#include <util/io/package.hpp>
+#include <util/version.hpp>
+#include <wx/wfstream.h>
+#include <wx/mstream.h>
+#include <wx/datstrm.h>
+
+String user_settings_dir();
+String safe_filename(const String& str);
+
+extern ScriptValueP script_warning;
+extern ScriptValueP script_warning_if_neq;
+
+ScriptCache script_cache;
+
+// ----------------------------------------------------------------------------- : Storing scripts
+
+/// Version of the cache format, should be incremented when instructions change
+const wxUint32 SCRIPT_CACHE_VERSION = 2;
+
+/// Kinds of constants in a stored script
+enum StoredConstant
+{  STORED_NIL
+,  STORED_TRUE
+,  STORED_FALSE
+,  STORED_INT
+,  STORED_DOUBLE
+,  STORED_STRING
+,  STORED_COLOR
+,  STORED_SCRIPT
+,  STORED_WARNING
+,  STORED_WARNING_IF_NEQ
+};
+
+/// Does an instruction have a variable as argument?
+/** Variable numbers differ between runs, so these are stored by name */
+static bool has_variable_argument(InstructionType t) {
+  return t == I_GET_VAR || t == I_SET_VAR || t == I_GET_VAR_MEMBER_C;
+}
+static bool has_argument_names(InstructionType t) {
+  return t == I_CALL || t == I_TAILCALL || t == I_CLOSURE;
+}
+
+static bool store_script(wxDataOutputStream& out, Script& script);
+
+/// Store a constant, returns false if it is of a type that can't be stored
+static bool store_constant(wxDataOutputStream& out, const ScriptValueP& c) {
+  if (c == script_warning) {
+    out.Write8(STORED_WARNING);
+  } else if (c == script_warning_if_neq) {
+    out.Write8(STORED_WARNING_IF_NEQ);
+  } else if (Script* s = dynamic_cast<Script*>(c.get())) {
+    out.Write8(STORED_SCRIPT);
+    return store_script(out, *s);
+  } else {
+    switch (c->type()) {
+      case SCRIPT_NIL:    out.Write8(STORED_NIL); break;
+      case SCRIPT_BOOL:   out.Write8(c->toBool() ? STORED_TRUE : STORED_FALSE); break;
+      case SCRIPT_INT:    out.Write8(STORED_INT);    out.Write32((wxUint32)c->toInt()); break;
+      case SCRIPT_DOUBLE: out.Write8(STORED_DOUBLE); out.WriteDouble(c->toDouble()); break;
+      case SCRIPT_STRING: out.Write8(STORED_STRING); out.WriteString(c->toString()); break;
+      case SCRIPT_COLOR: {
+        Color color = c->toColor();
+        out.Write8(STORED_COLOR);
+        out.Write8(color.r); out.Write8(color.g); out.Write8(color.b); out.Write8(color.a);
+        break;
+      }
+      default:
+        return false;
+    }
+  }
+  return true;
+}
+
+static bool store_script(wxDataOutputStream& out, Script& script) {
+  const vector<Instruction>& instructions = script.getInstructions();
+  out.Write32((wxUint32)instructions.size());
+  for (size_t pos = 0 ; pos < instructions.size() ; ++pos) {
+    const Instruction& i = instructions[pos];
+    out.Write8(i.instr);
+    if (has_variable_argument(i.instr)) {
+      out.WriteString(variable_to_string((Variable)i.data));
+    } else {
+      out.Write32(i.data);
+    }
+    if (has_argument_names(i.instr)) {
+      for (unsigned int j = 1 ; j <= i.data ; ++j) {
+        out.WriteString(variable_to_string((Variable)instructions[pos + j].data));
+      }
+      pos += i.data;
+    }
+  }
+  const vector<ScriptValueP>& constants = script.getConstants();
+  out.Write32((wxUint32)constants.size());
+  FOR_EACH_CONST(c, constants) {
+    if (!store_constant(out, c)) return false;
+  }
+  return true;
+}
+
+static ScriptP load_script(wxDataInputStream& in);
+
+/// Are the instructions of a loaded script safe to run?
+/** Cache files can be corrupted or edited, the opcodes, jump targets and constant indices are checked.
+ */
+static bool valid_instructions(const vector<Instruction>& instructions, size_t constant_count) {
+  size_t size = instructions.size();
+  for (size_t pos = 0 ; pos < size ; ++pos) {
+    const Instruction& i = instructions[pos];
+    switch (i.instr) {
+      case I_NOP: case I_GET_VAR: case I_SET_VAR: case I_MAKE_OBJECT: case I_DUP: case I_POP:
+        break;
+      case I_PUSH_CONST: case I_MEMBER_C: case I_PUSH_CONST_BINARY:
+        if (i.data >= constant_count) return false;
+        break;
+      case I_JUMP: case I_JUMP_IF_NOT: case I_JUMP_SC_AND: case I_JUMP_SC_OR:
+      case I_LOOP: case I_LOOP_WITH_KEY:
+        if (i.data > size) return false;
+        break;
+      case I_CALL_FOLDED:
+        // followed by: push result; get f
+        if (i.data > size || pos + 2 >= size) return false;
+        if (instructions[pos + 1].instr != I_PUSH_CONST || instructions[pos + 2].instr != I_GET_VAR) return false;
+        break;
+      case I_CALL: case I_TAILCALL: case I_CLOSURE:
+        pos += i.data; // argument names, they were read as such
+        break;
+      case I_GET_VAR_MEMBER_C:
+        if (pos + 1 >= size || instructions[pos + 1].instr != I_MEMBER_C) return false;
+        break;
+      case I_UNARY:
+        if (i.instr1 > I_NOT) return false;
+        break;
+      case I_BINARY:
+        if (i.instr2 > I_OR_ELSE) return false;
+        break;
+      case I_BINARY_JUMP_IF_NOT:
+        if (i.instr2 > I_OR_ELSE || pos + 1 >= size || instructions[pos + 1].instr != I_JUMP_IF_NOT) return false;
+        break;
+      case I_TERNARY:
+        if (i.instr3 != I_RGB) return false;
+        break;
+      case I_QUATERNARY:
+        if (i.instr4 != I_RGBA) return false;
+        break;
+      default:
+        return false;
+    }
+  }
+  return true;
+}
+
+static ScriptValueP load_constant(wxDataInputStream& in) {
+  switch (in.Read8()) {
+    case STORED_NIL:            return script_nil;
+    case STORED_TRUE:           return script_true;
+    case STORED_FALSE:          return script_false;
+    case STORED_INT:            return to_script((int)in.Read32());
+    case STORED_DOUBLE:         return to_script(in.ReadDouble());
+    case STORED_STRING:         return to_script(in.ReadString());
+    case STORED_COLOR: {
+      Color color;
+      color.r = in.Read8(); color.g = in.Read8(); color.b = in.Read8(); color.a = in.Read8();
+      return to_script(color);
+    }
+    case STORED_SCRIPT:         return load_script(in);
+    case STORED_WARNING:        return script_warning;
+    case STORED_WARNING_IF_NEQ: return script_warning_if_neq;
+    default:                    return ScriptValueP(); // corrupt
+  }
+}
+
+static ScriptP load_script(wxDataInputStream& in) {
+  ScriptP script = make_intrusive<Script>();
+  vector<Instruction>& instructions = script->getInstructions();
+  wxUint32 count = in.Read32();
+  instructions.reserve(count);
+  while (instructions.size() < count) {
+    Instruction i;
+    wxUint8 instr = in.Read8();
+    i.instr = (InstructionType)instr;
+    if (i.instr != instr) return ScriptP(); // doesn't fit, corrupt
+    if (has_variable_argument(i.instr)) {
+      i.data = string_to_variable(in.ReadString());
+    } else {
+      wxUint32 data = in.Read32();
+      i.data = data;
+      if (i.data != data) return ScriptP();
+    }
+    instructions.push_back(i);
+    if (has_argument_names(i.instr)) {
+      for (unsigned int j = 0 ; j < i.data ; ++j) {
+        Instruction arg;
+        arg.instr = I_NOP;
+        arg.data  = string_to_variable(in.ReadString());
+        instructions.push_back(arg);
+      }
+    }
+    if (!in.IsOk()) return ScriptP();
+  }
+  vector<ScriptValueP>& constants = script->getConstants();
+  wxUint32 constant_count = in.Read32();
+  for (wxUint32 j = 0 ; j < constant_count && in.IsOk() ; ++j) {
+    ScriptValueP c = load_constant(in);
+    if (!c) return ScriptP();
+    constants.push_back(c);
+  }
+  if (!in.IsOk()) return ScriptP();
+  if (instructions.size() != count || !valid_instructions(instructions, constants.size())) return ScriptP();
+  script->internMemberNames();
+  return script;
+}
+
+// ----------------------------------------------------------------------------- : Cache files
+
+static String script_cache_dir() {
+  String dir = user_settings_dir() + _("/cache");
+  if (!wxDirExists(dir)) wxMkdir(dir);
+  return dir + _("/");
+}
+
+/// Header of a cache file, the file is only used if the header matches
+static void write_header(wxDataOutputStream& out, const String& package_filename, wxLongLong modified) {
+  out.WriteString(_("MSE script cache"));
+  out.Write32(SCRIPT_CACHE_VERSION);
+  out.WriteString(app_version.toString());
+  out.WriteString(package_filename);
+  out.Write64((wxUint64)modified.GetValue());
+}
+static bool read_header(wxDataInputStream& in, const String& package_filename, wxLongLong modified) {
+  return in.ReadString() == _("MSE script cache")
+      && in.Read32()     == SCRIPT_CACHE_VERSION
+      && in.ReadString() == app_version.toString()
+      && in.ReadString() == package_filename
+      && in.Read64()     == (wxUint64)modified.GetValue()
+      && in.IsOk();
+}
+
+/// Name of the cache file for a package
+/** Packages with the same relative name can be installed in different data directories,
+ *  so a hash of the absolute filename is included.
+ */
+static String cache_filename(const Packaged& package) {
+  // FNV-1a, so the name doesn't change between runs or builds
+  wxUint32 hash = 2166136261u;
+  FOR_EACH_CONST(c, package.absoluteFilename()) {
+    hash = (hash ^ (wxUint32)c) * 16777619u;
+  }
+  return script_cache_dir() + safe_filename(package.relativeFilename()) + String::Format(_("-%08x.scripts"), hash);
+}
+
+ScriptCache::PackageScripts& ScriptCache::scriptsFor(const Packaged& package) {
+  auto inserted = packages.try_emplace(package.absoluteFilename());
+  PackageScripts& scripts = inserted.first->second;
+  if (!inserted.second) return scripts;
+  // read the cache file, if it is for this version of the package
+  scripts.filename = cache_filename(package);
+  scripts.modified = package.lastModified().GetValue();
+  if (!wxFileExists(scripts.filename)) return scripts;
+  wxFileInputStream file(scripts.filename);
+  if (!file.IsOk()) return scripts;
+  wxDataInputStream in(file);
+  if (!read_header(in, package.absoluteFilename(), scripts.modified)) return scripts;
+  wxUint32 count = in.Read32();
+  for (wxUint32 j = 0 ; j < count && in.IsOk() ; ++j) {
+    bool     string_mode = in.Read8() != 0;
+    String   source      = in.ReadString();
+    wxUint32 size        = in.Read32();
+    if (!in.IsOk() || size > file.GetLength()) break; // corrupt
+    std::string code(size, '\0');
+    in.Read8((wxUint8*)&code[0], code.size());
+    if (in.IsOk()) scripts.scripts.emplace(make_pair(string_mode, source), move(code));
+  }
+  return scripts;
+}
+
+void ScriptCache::write() {
+  lock_guard<mutex> guard(lock);
+  FOR_EACH(p, packages) {
+    PackageScripts& scripts = p.second;
+    if (!scripts.changed) continue;
+    scripts.changed = false;
+    // write to a temporary file first, so a cache file is never left half written
+    String temp_filename = scripts.filename + _(".tmp");
+    {
+      wxFileOutputStream file(temp_filename);
+      if (!file.IsOk()) continue; // not important enough to report
+      wxDataOutputStream out(file);
+      write_header(out, p.first, scripts.modified.GetValue());
+      out.Write32((wxUint32)scripts.scripts.size());
+      FOR_EACH_CONST(s, scripts.scripts) {
+        out.Write8(s.first.first);
+        out.WriteString(s.first.second);
+        out.Write32((wxUint32)s.second.size());
+        out.Write8((const wxUint8*)s.second.data(), s.second.size());
+      }
+      if (!file.Close()) {
+        wxRemoveFile(temp_filename);
+        continue;
+      }
+    }
+    if (!wxRenameFile(temp_filename, scripts.filename, true)) {
+      wxRemoveFile(temp_filename);
+    }
+  }
+}
+
+// ----------------------------------------------------------------------------- : Parsing
+
+ScriptP ScriptCache::parse(const String& source, Packaged* package, bool string_mode, vector<ScriptParseError>& errors_out) {
+  // Scripts from sets are not worth caching,
+  // and scripts that include files depend on more than their source.
+  if (!package || package->absoluteFilename().EndsWith(_(".mse-set")) || source.find(_("include")) != String::npos) {
+    return ::parse(source, package, string_mode, errors_out);
+  }
+  {
+    lock_guard<mutex> guard(lock);
+    PackageScripts& scripts = scriptsFor(*package);
+    auto it = scripts.scripts.find(make_pair(string_mode, source));
+    if (it != scripts.scripts.end()) {
+      wxMemoryInputStream stream(it->second.data(), it->second.size());
+      wxDataInputStream in(stream);
+      ScriptP script = load_script(in);
+      if (script) return script;
+      scripts.scripts.erase(it); // corrupt entry
+    }
+  }
+  ScriptP script = ::parse(source, package, string_mode, errors_out);
+  if (script && errors_out.empty()) {
+    wxMemoryOutputStream stream;
+    wxDataOutputStream out(stream);
+    if (store_script(out, *script)) {
+      std::string code(stream.GetLength(), '\0');
+      stream.CopyTo(&code[0], code.size());
+      lock_guard<mutex> guard(lock);
+      PackageScripts& scripts = scriptsFor(*package);
+      scripts.scripts.emplace(make_pair(string_mode, source), move(code));
+      scripts.changed = true;
+    }
+  }
+  return script;
+}
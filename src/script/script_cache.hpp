@@ -0,0 +1,49 @@
+//+----------------------------------------------------------------------------+
+//| Description:  Magic Set Editor - Program to make Magic (tm) cards          |
+//| Copyright:    (C) Twan van Laarhoven and the other MSE developers          |
+//| License:      GNU General Public License 2 or later (see file COPYING)     |
+//+----------------------------------------------------------------------------+
+
+#pragma once
+
+// ----------------------------------------------------------------------------- : Includes
+
+#include <util/prec.hpp>
+#include <script/parser.hpp>
+#include <mutex>
+
+class Packaged;
+
+// ----------------------------------------------------------------------------- : ScriptCache
+
+/// A cache of compiled scripts from packages, stored on disk, so they don't have to be parsed every time
+/** There is a cache file for each package, which is discarded when the package is modified.
+ *  Scripts are looked up by their source code, so a script is never mistaken for another.
+ *  Scripts that include other files are not cached.
+ */
+class ScriptCache {
+public:
+  /// Parse a script from a package, or load it from the cache
+  /** Behaves like ::parse */
+  ScriptP parse(const String& source, Packaged* package, bool string_mode, vector<ScriptParseError>& errors_out);
+  
+  /// Write the cache files of packages that have new scripts
+  void write();
+  
+private:
+  /// The cached scripts of a package
+  struct PackageScripts {
+    String     filename;        ///< Cache file
+    wxLongLong modified;        ///< Modification time of the package
+    bool       changed = false; ///< Have scripts been added since the file was read?
+    map<pair<bool,String>,std::string> scripts; ///< Compiled scripts, by string_mode and source
+  };
+  map<String,PackageScripts> packages; ///< Cached scripts, by absolute package filename
+  mutex lock; ///< Packages can be loaded from multiple threads
+  
+  /// Get the scripts of a package, reading the cache file if needed
+  PackageScripts& scriptsFor(const Packaged& package);
+};
+
+/// The global script cache
+extern ScriptCache script_cache;
@@ -20,6 +20,8 @@
 #include <data/action/value.hpp>
 #include <data/action/keyword.hpp>
 #include <util/error.hpp>
+#include <thread>
+#include <atomic>
 
 // ----------------------------------------------------------------------------- : SetScriptContext : initialization
 
@@ -79,6 +81,8 @@ Context& SetScriptContext::getContext(const CardP& card) {
 SetScriptManager::SetScriptManager(Set& set)
   : SetScriptContext(set)
   , delay(0)
+  , delay_other_cards(nullptr)
+  , delaying(false)
 {
   // add as an action listener for the set, so we receive actions
   set.actions.addListener(this);
@@ -100,6 +104,80 @@ void SetScriptManager::onInit(const StyleSheetP& stylesheet, Context& ctx) {
   }
 }
 
+/// Topological sort of the fields of a game, by a depth first search of Field::dependent_scripts
+class FieldRanker {
+public:
+  FieldRanker(const Game& game) : game(game) {}
+  
+  void visit(Field* f) {
+    int& s = state[f];
+    if (s == DONE) return;
+    if (s == VISITING) {
+      // a cycle, report it, from the first time f appears on the path
+      String cycle;
+      for (size_t i = find(path.begin(), path.end(), f) - path.begin() ; i < path.size() ; ++i) {
+        cycle += path[i]->name + _(" -> ");
+      }
+      cycles.push_back(cycle + f->name);
+      return;
+    }
+    s = VISITING;
+    path.push_back(f);
+    visitDependents(f->dependent_scripts);
+    path.pop_back();
+    state[f] = DONE;
+    finished.push_back(f);
+  }
+  
+  /// Assign ranks, this is the reverse of the order in which fields were finished
+  void assignRanks() {
+    for (size_t i = 0 ; i < finished.size() ; ++i) {
+      finished[i]->update_rank = (int)(finished.size() - i - 1);
+    }
+  }
+  
+  vector<String> cycles; ///< Cycles found, as "a -> b -> a"
+  
+private:
+  enum { NEW = 0, VISITING, DONE };
+  const Game& game;
+  unordered_map<const Field*,int> state;
+  vector<Field*> path;     ///< Fields currently being visited
+  vector<Field*> finished; ///< Fields in the order they were finished
+  
+  // follows the same dependencies as SetScriptManager::alsoUpdate
+  void visitDependents(const vector<Dependency>& deps) {
+    FOR_EACH_CONST(d, deps) {
+      switch (d.type) {
+        case DEP_SET_FIELD:
+          visit(game.set_fields.at(d.index).get());
+          break;
+        case DEP_CARD_FIELD: case DEP_CARDS_FIELD:
+          visit(game.card_fields.at(d.index).get());
+          break;
+        case DEP_CARD_COPY_DEP:
+          visitDependents(game.card_fields.at(d.index)->dependent_scripts);
+          break;
+        case DEP_SET_COPY_DEP:
+          visitDependents(game.set_fields.at(d.index)->dependent_scripts);
+          break;
+        default:
+          break;
+      }
+    }
+  }
+};
+
+static void rank_fields(Game& game) {
+  FieldRanker ranker(game);
+  FOR_EACH(f, game.set_fields)  ranker.visit(f.get());
+  FOR_EACH(f, game.card_fields) ranker.visit(f.get());
+  ranker.assignRanks();
+  FOR_EACH(c, ranker.cycles) {
+    queue_message(MESSAGE_WARNING, _("Circular dependency between fields of ") + game.name() + _(": ") + c);
+  }
+}
+
 void SetScriptManager::initDependencies(Context& ctx, Game& game) {
   if (game.dependencies_initialized) return;
   game.dependencies_initialized = true;
@@ -111,6 +189,8 @@ void SetScriptManager::initDependencies(Context& ctx, Game& game) {
   FOR_EACH(f, game.set_fields) {
     f->initDependencies(ctx, Dependency(DEP_SET_FIELD, f->index));
   }
+  // order the fields, so each value has to be updated only once
+  rank_fields(game);
 }
 
 
@@ -176,6 +256,11 @@ void SetScriptManager::onAction(const Action& action, bool undone) {
           v->update(ctx);
         }
       }
+    } else {
+      // removed cards don't have to be updated anymore, they are updated when they are added back
+      FOR_EACH_CONST(step, action.action.steps) {
+        dropDelayed(step.item);
+      }
     }
     // note: fallthrough
   }
@@ -244,19 +329,67 @@ void SetScriptManager::updateDelayed() {
     updateAllDependend(set.game->dependent_scripts_keywords);
   }
   delay = 0;
+  updateDelayed(delayed_values);
+}
+
+void SetScriptManager::updateDelayed(const CardP& card) {
+  UpdateQueue values;
+  for (auto it = delayed_values.begin() ; it != delayed_values.end() ; ) {
+    if (it->card == card) {
+      values.insert(*it);
+      it = delayed_values.erase(it);
+    } else {
+      ++it;
+    }
+  }
+  updateDelayed(values);
+}
+
+void SetScriptManager::dropDelayed(const CardP& card) {
+  for (auto it = delayed_values.begin() ; it != delayed_values.end() ; ) {
+    if (it->card == card) {
+      it = delayed_values.erase(it);
+    } else {
+      ++it;
+    }
+  }
+}
+
+bool SetScriptManager::updateDelayedStep() {
+  if (delayed_values.empty()) return false;
+  CardP card = delayed_values.begin()->card;
+  updateDelayed(card);
+  return !delayed_values.empty();
+}
+
+void SetScriptManager::updateDelayed(UpdateQueue& values) {
+  if (values.empty()) return;
+  // move to a new queue first, updating can add more delayed values
+  UpdateQueue to_update;
+  to_update.swap(values);
+  updateRecursive(to_update, Age());
 }
 
 void SetScriptManager::updateValue(Value& value, const CardP& card) {
   Age starting_age; // the start of the update process
-  deque<ToUpdate> to_update;
+  UpdateQueue to_update;
   // execute script for initial changed value
   value.update(getContext(card));
   #ifdef LOG_UPDATES
     wxLogDebug(_("Start:     %s"), value.fieldP->name);
   #endif
-  // update dependent scripts
-  alsoUpdate(to_update, value.fieldP->dependent_scripts, card);
-  updateRecursive(to_update, starting_age);
+  // update dependent scripts,
+  // values on other cards are only updated when someone looks at them, or when there is time to spare
+  delay_other_cards = card.get();
+  delaying = true;
+  try {
+    alsoUpdate(to_update, value.fieldP->dependent_scripts, card);
+    updateRecursive(to_update, starting_age);
+  } catch (...) {
+    delaying = false;
+    throw;
+  }
+  delaying = false;
   #ifdef LOG_UPDATES
     wxLogDebug(_("-------------------------------\n"));
   #endif
@@ -267,6 +400,7 @@ void SetScriptManager::updateAll() {
     wxLogDebug(_("Update all"));
   #endif
   wxBusyCursor busy;
+  delayed_values.clear(); // everything is updated anyway
   // update set data
   Context& ctx = getContext(set.stylesheet);
   FOR_EACH(v, set.data) {
@@ -278,9 +412,85 @@ void SetScriptManager::updateAll() {
     }
   }
   // update card data of all cards
+  updateAllCards();
+  // update things that depend on the card list
+  updateAllDependend(set.game->dependent_scripts_cards);
+  #ifdef LOG_UPDATES
+    wxLogDebug(_("-------------------------------\n"));
+  #endif
+}
+
+/// Mark the card fields that alsoUpdate would update for deps when there is no card
+static void mark_card_fields(vector<bool>& marked, const Game& game, const vector<Dependency>& deps) {
+  FOR_EACH_CONST(d, deps) {
+    if (d.type == DEP_CARD_FIELD || d.type == DEP_CARDS_FIELD) {
+      marked.at(d.index) = true;
+    } else if (d.type == DEP_CARD_COPY_DEP) {
+      mark_card_fields(marked, game, game.card_fields[d.index]->dependent_scripts);
+    } else if (d.type == DEP_SET_COPY_DEP) {
+      mark_card_fields(marked, game, game.set_fields[d.index]->dependent_scripts);
+    }
+  }
+}
+
+void SetScriptManager::updateAllCards() {
+  if (set.cards.empty()) return;
+  // Fields that depend on the card list can look at other cards (and use the order cache),
+  // they are updated by updateAllDependend afterwards, on this thread.
+  // The analysis can miss some of them, e.g. position_of in contexts made when the set had no cards,
+  // so the order cache is locked as well.
+  vector<bool> skip(set.game->card_fields.size(), false);
+  mark_card_fields(skip, *set.game, set.game->dependent_scripts_cards);
+  // Everything that is initialized lazily has to be initialized before starting the workers:
+  // the contexts (init scripts and dependencies), the styling data and the keyword database.
+  vector<ScriptValueP> stylings;
+  stylings.reserve(set.cards.size());
   FOR_EACH(card, set.cards) {
-    Context& ctx = getContext(card);
+    getContext(set.stylesheetForP(card));
+    stylings.push_back(to_script(&set.stylingDataFor(card)));
+  }
+  set.keywordDatabase();
+  #if USE_SCRIPT_PROFILING
+    size_t thread_count = 1; // the profiler is not thread safe
+  #else
+    size_t thread_count = min((size_t)max(1u, thread::hardware_concurrency()), set.cards.size());
+  #endif
+  // Each worker takes the next card, and evaluates its scripts in a private copy of the contexts.
+  // The copies are made here, the original contexts are used by position_of from any worker, see Set::order_cache_mutex.
+  vector<map<const StyleSheet*,Context>> contexts_of_worker(thread_count, contexts);
+  atomic<size_t> next_card(0);
+  mutex          error_mutex;
+  exception_ptr  error; // the first unexpected exception, rethrown on this thread
+  auto work = [&](map<const StyleSheet*,Context>& worker_contexts) {
+    try {
+      updateCards(worker_contexts, next_card, skip, stylings);
+    } catch (...) {
+      lock_guard<mutex> lock(error_mutex);
+      if (!error) error = current_exception();
+      next_card = set.cards.size(); // stop the other workers
+    }
+  };
+  vector<thread> workers;
+  for (size_t i = 1 ; i < thread_count ; ++i) {
+    try {
+      workers.emplace_back(work, ref(contexts_of_worker[i]));
+    } catch (const system_error&) {
+      break; // make do with fewer threads
+    }
+  }
+  work(contexts_of_worker[0]); // this thread is a worker as well
+  FOR_EACH(w, workers) w.join();
+  if (error) rethrow_exception(error);
+}
+
+void SetScriptManager::updateCards(map<const StyleSheet*,Context>& worker_contexts, atomic<size_t>& next_card, const vector<bool>& skip, const vector<ScriptValueP>& stylings) {
+  for (size_t i = next_card++ ; i < set.cards.size() ; i = next_card++) {
+    const CardP& card = set.cards[i];
+    Context& ctx = worker_contexts[&set.stylesheetFor(card)];
+    ctx.setVariable(SCRIPT_VAR_card,    to_script(card));
+    ctx.setVariable(SCRIPT_VAR_styling, stylings[i]);
     FOR_EACH(v, card->data) {
+      if (skip[v->fieldP->index]) continue;
       try {
         #if USE_SCRIPT_PROFILING
           Timer t;
@@ -289,33 +499,40 @@ void SetScriptManager::updateAll() {
         v->update(ctx);
       } catch (const ScriptError& e) {
         handle_error(ScriptError(e.what() + _("\n  while updating card value '") + v->fieldP->name + _("'")));
+      } catch (const Error& e) {
+        handle_error(e);
       }
     }
   }
-  // update things that depend on the card list
-  updateAllDependend(set.game->dependent_scripts_cards);
-  #ifdef LOG_UPDATES
-    wxLogDebug(_("-------------------------------\n"));
-  #endif
 }
 
 void SetScriptManager::updateAllDependend(const vector<Dependency>& dependent_scripts, const CardP& card) {
-  deque<ToUpdate> to_update;
+  UpdateQueue to_update;
   Age starting_age;
   alsoUpdate(to_update, dependent_scripts, card);
   updateRecursive(to_update, starting_age);
 }
 
-void SetScriptManager::updateRecursive(deque<ToUpdate>& to_update, Age starting_age) {
+bool SetScriptManager::ToUpdate::operator < (const ToUpdate& that) const {
+  int rank = value->fieldP->update_rank, that_rank = that.value->fieldP->update_rank;
+  if (rank != that_rank) return rank < that_rank;
+  return value < that.value;
+}
+
+void SetScriptManager::updateRecursive(UpdateQueue& to_update, Age starting_age) {
   if (to_update.empty()) return;
-  set.clearOrderCache(); // clear caches before evaluating a round of scripts
+  set.invalidateOrderCache(); // values may have changed before this round of scripts
+  // Values are updated in dependency order, so a value is only updated after everything it depends on.
+  // Only with cyclic dependencies can something earlier in the order be added again,
+  // the age check in updateToUpdate makes sure that this terminates.
   while (!to_update.empty()) {
-    updateToUpdate(to_update.front(), to_update, starting_age);
-    to_update.pop_front();
+    ToUpdate u = *to_update.begin();
+    to_update.erase(to_update.begin());
+    updateToUpdate(u, to_update, starting_age);
   }
 }
 
-void SetScriptManager::updateToUpdate(const ToUpdate& u, deque<ToUpdate>& to_update, Age starting_age) {
+void SetScriptManager::updateToUpdate(const ToUpdate& u, UpdateQueue& to_update, Age starting_age) {
   Age age = u.value->last_script_update;
   if (starting_age <= age)  return; // this value was already updated
   Context& ctx = getContext(u.card);
@@ -341,26 +558,30 @@ void SetScriptManager::updateToUpdate(const ToUpdate& u, deque<ToUpdate>& to_upd
   #endif
 }
 
-void SetScriptManager::alsoUpdate(deque<ToUpdate>& to_update, const vector<Dependency>& deps, const CardP& card) {
+void SetScriptManager::alsoUpdate(UpdateQueue& to_update, const vector<Dependency>& deps, const CardP& card) {
   FOR_EACH_CONST(d, deps) {
     switch (d.type) {
       case DEP_SET_FIELD: {
         ValueP value = set.data.at(d.index);
-        to_update.push_back(ToUpdate(value.get(), CardP()));
+        to_update.insert(ToUpdate(value.get(), CardP()));
         break;
       } case DEP_CARD_FIELD: {
         if (card) {
           ValueP value = card->data.at(d.index);
-          to_update.push_back(ToUpdate(value.get(), card));
+          to_update.insert(ToUpdate(value.get(), card));
           break;
         } else {
           // There is no card, so the update should affect all cards (fall through).
         }
       } case DEP_CARDS_FIELD: {
         // something invalidates a card value for all cards, so all cards need updating
-        FOR_EACH(card, set.cards) {
-          ValueP value = card->data.at(d.index);
-          to_update.push_back(ToUpdate(value.get(), card));
+        FOR_EACH(c, set.cards) {
+          ValueP value = c->data.at(d.index);
+          if (delaying && c.get() != delay_other_cards) {
+            delayed_values.insert(ToUpdate(value.get(), c));
+          } else {
+            to_update.insert(ToUpdate(value.get(), c));
+          }
         }
         break;
       } case DEP_CARD_STYLE: {
@@ -380,7 +601,7 @@ void SetScriptManager::alsoUpdate(deque<ToUpdate>& to_update, const vector<Depen
           StyleSheet* stylesheet_card = &set.stylesheetFor(card);
           if (stylesheet == stylesheet_card) {
             ValueP value = card->extra_data.at(d.index);
-            to_update.push_back(ToUpdate(value.get(), card));
+            to_update.insert(ToUpdate(value.get(), card));
           }
         }*/
         break;
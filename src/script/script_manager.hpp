@@ -14,6 +14,7 @@
 #include <script/context.hpp>
 #include <script/dependency.hpp>
 #include <queue>
+#include <atomic>
 
 class Set;
 class Value;
@@ -63,6 +64,11 @@ public:
   
   /// Update expensive things that were previously delayed
   void updateDelayed();
+  /// Update the delayed values of a single card
+  void updateDelayed(const CardP& card);
+  /// Update the delayed values of some card, for doing work in idle time
+  /** Returns true if there are more delayed values */
+  bool updateDelayedStep();
   
   /// Update all fields of all cards
   /** Update all set info fields
@@ -76,6 +82,12 @@ private:
   void initDependencies(Context&, Game&);
   void initDependencies(Context&, StyleSheet&);
   
+  /// Update the card fields of all cards, using multiple threads
+  /** Fields that depend on the card list are skipped, they should be updated afterwards */
+  void updateAllCards();
+  /// Update cards for updateAllCards, taking the next card index until there are no cards left
+  void updateCards(map<const StyleSheet*,Context>& contexts, atomic<size_t>& next_card, const vector<bool>& skip, const vector<ScriptValueP>& stylings);
+  
   /// Update a map of styles
   void updateStyles(Context& ctx, const IndexMap<FieldP,StyleP>& styles, bool only_content_dependent);
   /// Updates scripts, starting at some value
@@ -89,14 +101,18 @@ private:
     ToUpdate(Value* value, CardP card) : value(value), card(card) {}
     Value* value;  ///< value to update
     CardP  card;   ///< card the value is in, or CadP() if it is not a card field
+    /// Values of fields that come first in the dependency order are updated first
+    bool operator < (const ToUpdate& that) const;
   };
+  /// Things that need to be updated, without duplicates, in the order they should be updated in
+  typedef std::set<ToUpdate> UpdateQueue;
   /// Update all things in to_update, and things that depent on them, etc.
   /** Only update things that are older than starting_age. */
-  void updateRecursive(deque<ToUpdate>& to_update, Age starting_age);
+  void updateRecursive(UpdateQueue& to_update, Age starting_age);
   /// Update a value given by a ToUpdate object, and add things depending on it to to_update
-  void updateToUpdate(const ToUpdate& u, deque<ToUpdate>& to_update, Age starting_age);
+  void updateToUpdate(const ToUpdate& u, UpdateQueue& to_update, Age starting_age);
   /// Schedule all things in deps to be updated by adding them to to_update
-  void alsoUpdate(deque<ToUpdate>& to_update, const vector<Dependency>& deps, const CardP& card);
+  void alsoUpdate(UpdateQueue& to_update, const vector<Dependency>& deps, const CardP& card);
   
   /// Delayed update for (bitmask)...
   enum Delay
@@ -105,6 +121,17 @@ private:
   };
   int delay;
   
+  /// When set, card values on other cards than this one are put in delayed_values instead of being updated
+  /** Only used while updating the values that depend on an edit, see updateValue */
+  const Card* delay_other_cards;
+  bool        delaying;
+  /// Card values that are out of date, but have not been updated yet because nobody is looking at them
+  UpdateQueue delayed_values;
+  /// Update (some of) the delayed values
+  void updateDelayed(UpdateQueue& values);
+  /// Forget the delayed values of a card that was removed from the set
+  void dropDelayed(const CardP& card);
+  
 protected:
   /// Respond to actions by updating scripts
   void onAction(const Action&, bool undone) override;
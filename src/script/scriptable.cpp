@@ -10,6 +10,7 @@
 #include <script/scriptable.hpp>
 #include <script/context.hpp>
 #include <script/parser.hpp>
+#include <script/script_cache.hpp>
 #include <script/script.hpp>
 #include <script/value.hpp>
 #include <gfx/color.hpp>
@@ -38,8 +39,10 @@ OptionalScript::OptionalScript(const String& script_)
 OptionalScript::~OptionalScript() {}
 
 ScriptValueP OptionalScript::invoke(Context& ctx, bool open_scope) const {
-  if (script) {
-    return ctx.eval(*script, open_scope);
+  if (script && open_scope) {
+    return ctx.evalCached(*script);
+  } else if (script) {
+    return ctx.eval(*script, false);
   } else {
     return script_nil;
   }
@@ -47,7 +50,7 @@ ScriptValueP OptionalScript::invoke(Context& ctx, bool open_scope) const {
 
 void OptionalScript::parse(Reader& reader, bool string_mode) {
   vector<ScriptParseError> errors;
-  script = ::parse(unparsed, reader.getPackage(), string_mode, errors);
+  script = script_cache.parse(unparsed, reader.getPackage(), string_mode, errors);
   // show parse errors as warnings
   String include_warnings;
   for (size_t i = 0 ; i < errors.size() ; ++i) {
@@ -49,6 +49,7 @@ public:
   inline operator bool() const { return !!script; }
   
   /// Invoke the script, return the result, or script_nil if there is no script
+  /** If open_scope, an earlier result is reused when the script's inputs haven't changed, see Context::evalCached */
   ScriptValueP invoke(Context& ctx, bool open_scope = true) const;
   
   /// Invoke the script on a value
@@ -60,7 +61,7 @@ public:
     if (script) {
       T new_value;
       ctx.setVariable(SCRIPT_VAR_value, to_script(value));
-      store(ctx.eval(*script), new_value);
+      store(ctx.evalCached(*script), new_value);
       if (value != new_value) {
         change(value, new_value);
         return true;
@@ -156,14 +156,19 @@ ScriptValueP get_member(const Container& m, const String& name) {
 }
 
 template <typename K, typename V>
-ScriptValueP get_member(const IndexMap<K,V>& m, const String& name) {
-  typename IndexMap<K,V>::const_iterator it = m.find(name);
+ScriptValueP get_member(const IndexMap<K,V>& m, const String& name, MemberCache* cache = nullptr) {
+  typename IndexMap<K,V>::const_iterator it = find_cached(m, name, cache);
   if (it != m.end()) {
     return to_script(*it);
   } else {
     return delay_error(ScriptErrorNoMember(_TYPE_("collection"), name));
   }
 }
+/// Other collections don't use an inline cache
+template <typename Collection>
+inline ScriptValueP get_member(const Collection& c, const String& name, MemberCache*) {
+  return get_member(c, name);
+}
 
 /// Script value containing a map-like collection
 template <typename Collection>
@@ -175,6 +180,9 @@ public:
   ScriptValueP getMember(const String& name) const override {
     return get_member(*value, name);
   }
+  ScriptValueP getMemberCached(const String& name, MemberCache& cache) const override {
+    return get_member(*value, name, &cache);
+  }
   int itemCount() const override { return (int)value->size(); }
   ScriptValueP dependencyMember(const String& name, const Dependency& dep) const override {
     mark_dependency_member(*value, name, dep);
@@ -267,23 +275,10 @@ public:
     ScriptValueP d = getDefault(); return d ? d->toImage() : ScriptValue::toImage();
   }
   ScriptValueP getMember(const String& name) const override {
-    #if USE_SCRIPT_PROFILING
-      Timer t;
-      Profiler prof(t, (void*)mangled_name(typeid(T)), _("get member of ") + type_name(*value));
-    #endif
-    // Use reflection to find the member of the object
-    GetMember gm(name);
-    gm.handle(*value);
-    if (gm.result()) return gm.result();
-    else {
-      // try nameless member
-      ScriptValueP d = getDefault();
-      if (d) {
-        return d->getMember(name);
-      } else {
-        return ScriptValue::getMember(name);
-      }
-    }
+    return findMember(name, nullptr);
+  }
+  ScriptValueP getMemberCached(const String& name, MemberCache& cache) const override {
+    return findMember(name, &cache);
   }
   ScriptValueP getIndex(int index) const override {
     ScriptValueP d = getDefault(); return d ? d->getIndex(index) : ScriptValue::getIndex(index);
@@ -328,6 +323,25 @@ private:
     gdm.handle(*value);
     return gdm.result();
   }
+  ScriptValueP findMember(const String& name, MemberCache* cache) const {
+    #if USE_SCRIPT_PROFILING
+      Timer t;
+      Profiler prof(t, (void*)mangled_name(typeid(T)), _("get member of ") + type_name(*value));
+    #endif
+    // Use reflection to find the member of the object
+    GetMember gm(name, cache);
+    gm.handle(*value);
+    if (gm.result()) return gm.result();
+    else {
+      // try nameless member
+      ScriptValueP d = getDefault();
+      if (d) {
+        return cache ? d->getMemberCached(name, *cache) : d->getMember(name);
+      } else {
+        return ScriptValue::getMember(name);
+      }
+    }
+  }
 };
 
 // ----------------------------------------------------------------------------- : Default arguments / closure
@@ -69,6 +69,9 @@ ScriptValueP ScriptValue::getMember(const String& name) const {
     return delay_error(ScriptErrorNoMember(typeName(), name));
   }
 }
+ScriptValueP ScriptValue::getMemberCached(const String& name, MemberCache&) const {
+  return getMember(name);
+}
 ScriptValueP ScriptValue::getIndex(int index) const {
   return delay_error(ScriptErrorNoMember(typeName(), String()<<index));
 }
@@ -241,7 +244,24 @@ private:
   }
 #endif
 
+/// Integers in this range are preallocated, so the most common values don't need an allocation
+const int SMALL_INT_MIN = -128;
+const int SMALL_INT_MAX = 1023;
+
+ScriptValueP* make_small_ints() {
+  // NOTE: this table is never freed, so the values outlive any global that might refer to them
+  ScriptValueP* small_ints = new ScriptValueP[SMALL_INT_MAX - SMALL_INT_MIN + 1];
+  for (int i = SMALL_INT_MIN ; i <= SMALL_INT_MAX ; ++i) {
+    small_ints[i - SMALL_INT_MIN] = make_intrusive<ScriptInt>(i);
+  }
+  return small_ints;
+}
+
 ScriptValueP to_script(int v) {
+  if (v >= SMALL_INT_MIN && v <= SMALL_INT_MAX) {
+    static ScriptValueP* small_ints = make_small_ints();
+    return small_ints[v - SMALL_INT_MIN];
+  }
 #if USE_POOL_ALLOCATOR
   #if USE_INTRUSIVE_PTR
     return ScriptValueP(
@@ -596,7 +616,8 @@ ScriptValueP ScriptClosure::simplify() {
 }
 
 ScriptValueP ScriptClosure::eval(Context& ctx, bool openScope) const {
-  unique_ptr<LocalScope> scope = openScope ? make_unique<LocalScope>(ctx) : nullptr;
+  optional<LocalScope> scope;
+  if (openScope) scope.emplace(ctx);
   applyBindings(ctx);
   return fun->eval(ctx, openScope);
 }
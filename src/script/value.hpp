@@ -43,6 +43,16 @@ enum CompareWhat
 ,  COMPARE_AS_POINTER
 };
 
+/// Inline cache for looking up a member with a constant name, there is one for each I_MEMBER_C instruction
+/** Remembers where the member was found the last time, so the search by name can be skipped.
+ *  Scripts are evaluated from multiple threads, and the same script is used for different maps,
+ *  so the position is only a guess: the name of the key found there is checked before it is used.
+ */
+struct MemberCache {
+  String         name;     ///< Name of the member, converted from the constant when the script is parsed
+  atomic<size_t> index{0}; ///< Position where the member was found
+};
+
 /// A value that can be handled by the scripting engine.
 /// Actual values are derived types
 class ScriptValue : public IntrusivePtrBaseWithDelete {
@@ -77,6 +87,8 @@ public:
 
   /// Get a member variable from this value
   virtual ScriptValueP getMember(const String& name) const;
+  /// Get a member variable from this value, the cache can be used to speed up repeated lookups
+  virtual ScriptValueP getMemberCached(const String& name, MemberCache& cache) const;
 
   /// Signal that a script depends on this value itself
   virtual void dependencyThis(const Dependency& dep);
@@ -32,8 +32,9 @@ template <> void GetDefaultMember::handle(const wxDateTime&   v) { value = to_sc
 
 // ----------------------------------------------------------------------------- : GetMember
 
-GetMember::GetMember(const String& name)
+GetMember::GetMember(const String& name, MemberCache* cache)
   : target_name(name)
+  , cache(cache)
 {}
 
 // caused by the pattern: if (!handler.isCompound()) { REFLECT_NAMELESS(stuff) }
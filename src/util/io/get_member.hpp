@@ -67,6 +67,27 @@ private:
   ScriptValueP value;    ///< The value we found (if any)
 };
 
+// ----------------------------------------------------------------------------- : Cached lookup
+
+/// Find a value in an IndexMap by name, skipping the search if the cache remembers where it is
+/** A hit is checked by comparing the name of the key at the cached position,
+ *  so the cache never gives a wrong member, even when maps or fields are replaced.
+ */
+template <typename K, typename V>
+typename IndexMap<K,V>::const_iterator find_cached(const IndexMap<K,V>& m, const String& name, MemberCache* cache) {
+  if (cache) {
+    size_t index = cache->index.load(memory_order_relaxed);
+    if (index < m.size() && get_key_name(*(m.begin() + index)) == name) {
+      return m.begin() + index;
+    }
+  }
+  typename IndexMap<K,V>::const_iterator it = m.find(name);
+  if (cache && it != m.end()) {
+    cache->index.store(it - m.begin(), memory_order_relaxed);
+  }
+  return it;
+}
+
 // ----------------------------------------------------------------------------- : GetMember
 
 /// Find a member with a specific name using reflection
@@ -74,7 +95,8 @@ private:
 class GetMember {
 public:
   /// Construct a member getter that looks for the given name
-  GetMember(const String& name);
+  /** If a cache is given it is used for finding the name in IndexMaps */
+  GetMember(const String& name, MemberCache* cache = nullptr);
   
   /// Tell the reflection code we are getting a member for scripting purposes
   static constexpr bool isReading = false;
@@ -103,11 +125,9 @@ public:
   /// Handle an index map: invistigate keys
   template <typename K, typename V> void handle(const IndexMap<K,V>& m) {
     if (gdm.result()) return;
-    for (typename IndexMap<K,V>::const_iterator it = m.begin() ; it != m.end() ; ++it) {
-      if (get_key_name(*it) == target_name) {
-        gdm.handle(*it);
-        return;
-      }
+    typename IndexMap<K,V>::const_iterator it = find_cached(m, target_name, cache);
+    if (it != m.end()) {
+      gdm.handle(*it);
     }
   }
   template <typename K, typename V> void handle(const DelayedIndexMaps<K,V>&);
@@ -115,6 +135,7 @@ public:
   
 private:
   const String& target_name;  ///< The name we are looking for
+  MemberCache* cache;          ///< Inline cache for the lookup, if any
   GetDefaultMember gdm;    ///< Object to store and retrieve the value
 };
 
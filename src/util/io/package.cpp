@@ -600,18 +600,21 @@ void Packaged::loadFully() {
 }
 
 void Packaged::save() {
+  beforeSave();
   WITH_DYNAMIC_ARG(writing_package, this);
   writeFile(typeName(), *this, fileVersion());
   referenceFile(typeName());
   Package::save();
 }
 void Packaged::saveAs(const String& package, bool remove_unused, bool as_directory) {
+  beforeSave();
   WITH_DYNAMIC_ARG(writing_package, this);
   writeFile(typeName(), *this, fileVersion());
   referenceFile(typeName());
   Package::saveAs(package, remove_unused, as_directory);
 }
 void Packaged::saveCopy(const String& package) {
+  beforeSave();
   WITH_DYNAMIC_ARG(writing_package, this);
   writeFile(typeName(), *this, fileVersion());
   referenceFile(typeName());
@@ -295,6 +295,8 @@ protected:
   virtual String typeName() const = 0;
   /// Can be overloaded to do validation after loading
   virtual void validate(Version file_app_version);
+  /// Can be overloaded to bring the data up to date before it is written by save, saveAs or saveCopy
+  virtual void beforeSave() {}
   /// What file version should be used for writing files?
   virtual Version fileVersion() const = 0;
 
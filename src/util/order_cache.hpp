@@ -13,7 +13,9 @@
 // ----------------------------------------------------------------------------- : OrderCache
 
 /// Object that cashes an ordered version of a list of items, for finding the position of objects
-/** Can be used as a map "void* -> int" for finding the position of an object */
+/** Can be used as a map "void* -> int" for finding the position of an object.
+ *  Items with the same value are ordered by their position in the list.
+ */
 template <typename T>
 class OrderCache : public IntrusivePtrBase<OrderCache<T>> {
 public:
@@ -23,62 +25,95 @@ public:
    */
   OrderCache(const vector<T>& keys, const vector<String>& values, vector<int>* keep = nullptr);
   
+  /// Update the order after the list of keys or some of the values have changed
+  /** Keys with the same value as before keep their relative order, only new and changed keys are (re)positioned.
+   *  For k changed keys this takes O(n + k log k) time, unless the list was reordered, then everything is sorted again.
+   *  @pre keys.size() == values.size()
+   */
+  void update(const vector<T>& keys, const vector<String>& values, vector<int>* keep = nullptr);
+  
   /// Find the position of the given key in the cache, returns -1 if not found
   int find(const T& key) const;
   
 private:
-  struct CompareKeys;
-  struct CompareValues;
-  typedef pair<void*,int> KV;
-  vector<KV> positions;
+  struct Item {
+    void*  key;
+    String value;
+    int    index; ///< Position of the key in the list
+  };
+  vector<Item>                   order;     ///< Items in sorted order
+  unordered_map<const void*,int> positions; ///< Position of each key in order
+  
+  static bool less(const Item& a, const Item& b);
+  void updatePositions();
 };
 
 // ----------------------------------------------------------------------------- : Implementation
 
 template <typename T>
-struct OrderCache<T>::CompareKeys {
-  inline bool operator () (const KV& a, void*     b) { return a.first < b; }
-  inline bool operator () (const KV& a, const KV& b) { return a.first < b.first; }
-  inline bool operator () (void*     a, const KV& b) { return a       < b.first; }
-};
+bool OrderCache<T>::less(const Item& a, const Item& b) {
+  int cmp = smart_compare(a.value, b.value);
+  if (cmp != 0) return cmp < 0;
+  return a.index < b.index;
+}
 
 template <typename T>
-struct OrderCache<T>::CompareValues {
-  const vector<String>& values;
-  CompareValues(const vector<String>& values) : values(values) {}
-  
-  inline bool operator () (const KV& a, const KV& b) {
-    return smart_less(values[a.second], values[b.second]);
-  }
-};
+OrderCache<T>::OrderCache(const vector<T>& keys, const vector<String>& values, vector<int>* keep) {
+  update(keys, values, keep);
+}
 
 template <typename T>
-OrderCache<T>::OrderCache(const vector<T>& keys, const vector<String>& values, vector<int>* keep) {
+void OrderCache<T>::update(const vector<T>& keys, const vector<String>& values, vector<int>* keep) {
   assert(keys.size() == values.size());
   assert(!keep || keep->size() == keys.size());
-  // initialize positions, use pos to point back to the values vector
-  positions.reserve(keys.size());
-  int i = 0;
-  for (typename vector<T>::const_iterator it = keys.begin() ; it != keys.end() ; ++it, ++i) {
-    if (!keep || (*keep)[i]) {
-      positions.push_back(KV(&**it, i));
-    }
+  // position in the list of the keys that are kept
+  unordered_map<const void*,int> index_of;
+  index_of.reserve(keys.size());
+  for (size_t i = 0 ; i < keys.size() ; ++i) {
+    if (!keep || (*keep)[i]) index_of[&*keys[i]] = (int)i;
+  }
+  // keep the items that are still there with the same value, they stay in order
+  vector<bool> placed(keys.size(), false);
+  bool sorted = true;
+  size_t j = 0;
+  for (size_t i = 0 ; i < order.size() ; ++i) {
+    Item& item = order[i];
+    auto it = index_of.find(item.key);
+    if (it == index_of.end() || values[it->second] != item.value) continue;
+    item.index = it->second;
+    placed[item.index] = true;
+    if (j != i) order[j] = move(item);
+    // the values are still in order, but if the list was reordered then items with the same value might not be
+    if (j > 0 && sorted && order[j].index < order[j-1].index && less(order[j], order[j-1])) sorted = false;
+    ++j;
   }
-  // sort the KVs by the values
-  sort(positions.begin(), positions.end(), CompareValues(values));
-  // update positions, to point to sorted list
-  i = 0;
-  for (typename vector<KV>::iterator it = positions.begin() ; it != positions.end() ; ++it, ++i) {
-    it->second = i;
+  order.resize(j);
+  if (!sorted) {
+    sort(order.begin(), order.end(), less);
+  }
+  // add new and changed items, sort just those and merge them in
+  size_t unchanged = order.size();
+  for (size_t i = 0 ; i < keys.size() ; ++i) {
+    if (placed[i] || (keep && !(*keep)[i])) continue;
+    order.push_back(Item{&*keys[i], values[i], (int)i});
+  }
+  sort(order.begin() + unchanged, order.end(), less);
+  inplace_merge(order.begin(), order.begin() + unchanged, order.end(), less);
+  updatePositions();
+}
+
+template <typename T>
+void OrderCache<T>::updatePositions() {
+  positions.clear();
+  positions.reserve(order.size());
+  for (size_t i = 0 ; i < order.size() ; ++i) {
+    positions[order[i].key] = (int)i;
   }
-  // sort the KVs by the keys
-  sort(positions.begin(), positions.end(), CompareKeys());
 }
 
 template <typename T>
 int OrderCache<T>::find(const T& key) const {
-  vector<KV>::const_iterator it = lower_bound(positions.begin(), positions.end(), &*key, CompareKeys());
-  if (it == positions.end() || it->first != &*key) return -1;
+  auto it = positions.find(&*key);
+  if (it == positions.end()) return -1;
   return it->second;
 }
-
@@ -9,6 +9,8 @@
 #include <util/prec.hpp>
 #include <util/spec_sort.hpp>
 #include <util/error.hpp>
+#include <list>
+#include <mutex>
 
 const Char REMOVED     = _('\0');
 const Char PLACEHOLDER = _('\3');
@@ -110,6 +112,170 @@ private:
   size_t pos;
 };
 
+// ----------------------------------------------------------------------------- : Compiled specifications
+
+/// A single step of a sort specification, see spec_sort
+struct SortStep {
+  enum Type
+  {  COUNT          ///< all of each of chars, in that order
+  ,  ONCE           ///< a single copy of each of chars
+  ,  MIXED          ///< chars, in input order
+  ,  CYCLE          ///< chars, in the shortest cycle order
+  ,  COMPOUND       ///< the compound item chars
+  ,  PATTERN        ///< things matching the pattern chars, sorted with sub_specs[0]
+  ,  IN_PLACE       ///< sort with sub_specs[0], keeping the rest of the input
+  ,  ANY            ///< the remaining input
+  ,  REVERSE_ORDER  ///< sort with each of sub_specs, and add the parts in reverse order
+  } type;
+  String chars;
+  vector<String> sub_specs; ///< Specifications of nested sorts, these are compiled when they are used
+  /// The characters of chars with their first position, sorted by character, for counting all of them in one pass.
+  /** Empty if chars contains REMOVED, then they must be counted one at a time */
+  vector<pair<Char,size_t>> slots;
+  
+  SortStep(Type type, const String& chars = String()) : type(type), chars(chars) {}
+  
+  void makeSlots() {
+    if (chars.find(REMOVED) != String::npos) return;
+    for (size_t i = 0 ; i < chars.size() ; ++i) {
+      Char c = chars[i];
+      auto it = findSlot(c);
+      if (it == slots.end() || it->first != c) slots.insert(it, make_pair(c, i));
+    }
+  }
+  
+  inline vector<pair<Char,size_t>>::const_iterator findSlot(Char c) const {
+    return lower_bound(slots.begin(), slots.end(), c, [](pair<Char,size_t> const& a, Char b) { return a.first < b; });
+  }
+};
+
+/// A sort specification, parsed into steps
+typedef vector<SortStep> SortProgram;
+typedef shared_ptr<const SortProgram> SortProgramP;
+
+/// Parse a sort specification
+SortProgram compile_spec(const String& spec) {
+  SortProgram program;
+  // consecutive single characters are merged into one step
+  auto add_count = [&program](wxUniChar c) {
+    if (c != REMOVED && !program.empty() && program.back().type == SortStep::COUNT && program.back().chars.find(REMOVED) == String::npos) {
+      program.back().chars += c;
+    } else {
+      program.emplace_back(SortStep::COUNT, String(1,c));
+    }
+  };
+  SpecIterator it(spec);
+  while(it.nextUntil(0)) {
+    if (it.escaped) { // single character, escaped
+      add_count(it.value);
+    } else if (it.value == _('<')) { // keep only a single copy
+      program.emplace_back(SortStep::ONCE);
+      while (it.nextUntil(_('>'))) {
+        program.back().chars += it.value;
+      }
+    } else if (it.keyword(_("once("))) {
+      program.emplace_back(SortStep::ONCE);
+      while (it.nextUntil(_(')'))) {
+        program.back().chars += it.value;
+      }
+      
+    } else if (it.value == _('[')) {  // in input order
+      program.emplace_back(SortStep::MIXED, it.readParam(_(']')));
+    } else if (it.keyword(_("mixed("))) {
+      program.emplace_back(SortStep::MIXED, it.readParam(_(')')));
+      
+    } else if (it.keyword(_("cycle("))) {
+      program.emplace_back(SortStep::CYCLE, it.readParam(_(')')));
+    } else if (it.value == _('(')) {
+      program.emplace_back(SortStep::CYCLE, it.readParam(_(')')));
+    
+    } else if (it.keyword(_("compound("))) { // compound item
+      program.emplace_back(SortStep::COMPOUND, it.readParam(_(')')));
+    
+    } else if (it.keyword(_("pattern("))) { // recurse with pattern
+      String pattern;
+      // read pattern
+      while (it.nextUntil(_(' '), false)) {
+        if (it.value == _('.') && !it.escaped) {
+          pattern += PLACEHOLDER;
+        } else {
+          pattern += it.value;
+        }
+      }
+      program.emplace_back(SortStep::PATTERN, pattern);
+      // read spec to apply to pattern
+      program.back().sub_specs.push_back(it.readRawParam(_(')')));
+    
+    } else if (it.keyword(_("in_place("))) { // recurse without pattern
+      program.emplace_back(SortStep::IN_PLACE);
+      program.back().sub_specs.push_back(it.readRawParam(_(')')));
+    
+    } else if (it.keyword(_("any()"))) { // remaining input
+      program.emplace_back(SortStep::ANY);
+    
+    } else if (it.keyword(_("reverse_order("))) { // reverse order of preference
+      program.emplace_back(SortStep::REVERSE_ORDER);
+      while (it.value != _(')')) {
+        program.back().sub_specs.push_back(it.readRawParam(_(')'),_(' ')));
+        if (it.value == 0) {
+          throw ParseError(_("Expected ')' in sort_rule specification"));
+        }
+      }
+    
+    } else if (it.keyword(_("ordered("))) { // in spec order
+      while (it.nextUntil(_(')'))) {
+        add_count(it.value);
+      }
+    } else { // single char
+      add_count(it.value);
+    }
+  }
+  for (SortStep& step : program) {
+    if (step.type == SortStep::COUNT || step.type == SortStep::CYCLE) step.makeSlots();
+  }
+  return program;
+}
+
+/// Cache of compiled sort specifications, so they are not parsed again for every string that is sorted
+class SortProgramCache {
+public:
+  /// Get the compiled program for the given specification
+  SortProgramP get(const String& spec);
+private:
+  static const size_t MAX_SIZE = 256;
+  typedef list<pair<String,SortProgramP>> Entries;
+  Entries                         entries; ///< Most recently used first
+  map<String, Entries::iterator>  index;
+  mutex                           lock;
+};
+
+SortProgramP SortProgramCache::get(const String& spec) {
+  {
+    lock_guard<mutex> guard(lock);
+    auto it = index.find(spec);
+    if (it != index.end()) {
+      entries.splice(entries.begin(), entries, it->second);
+      return it->second->second;
+    }
+  }
+  // compile without holding the lock, this can throw for invalid specifications
+  SortProgramP program = make_shared<SortProgram>(compile_spec(spec));
+  lock_guard<mutex> guard(lock);
+  auto it = index.find(spec);
+  if (it != index.end()) {
+    return it->second->second; // another thread was first
+  }
+  entries.emplace_front(spec, program);
+  index.emplace(spec, entries.begin());
+  if (entries.size() > MAX_SIZE) {
+    index.erase(entries.back().first);
+    entries.pop_back();
+  }
+  return program;
+}
+
+SortProgramCache sort_program_cache;
+
 // ----------------------------------------------------------------------------- : Sort functions
 
 //using Bag = vector<wxUniChar>;
@@ -117,27 +283,42 @@ using Bag = String;
 
 size_t count_and_remove(wxUniChar c, Bag& input) {
   size_t count = 0;
-  size_t j=0;
   for (size_t i=0 ; i < input.size() ; ++i) {
     if (input[i] == c) {
       count++;
       input[i] = REMOVED;
-    } else {
-      //input[j++] = input[i];
     }
   }
-  //input.resize(j);
   return count;
 }
 
+/// Count and remove all of step.chars from input, counts[i] becomes the number of step.chars[i]
+/** This is the same as count_and_remove for each character in turn, but in a single pass */
+void count_and_remove(const SortStep& step, Bag& input, vector<size_t>& counts) {
+  counts.assign(step.chars.size(), 0);
+  if (step.slots.empty()) {
+    for (size_t i = 0 ; i < step.chars.size() ; ++i) {
+      counts[i] = count_and_remove(step.chars[i], input);
+    }
+    return;
+  }
+  for (wxUniCharRef c : input) {
+    Char ch = c;
+    auto it = step.findSlot(ch);
+    if (it != step.slots.end() && it->first == ch) {
+      counts[it->second]++;
+      c = REMOVED;
+    }
+  }
+}
+
 /// Sort a string using a specification using the shortest cycle method, see spec_sort
 /** Removed used characters from input! */
-void cycle_sort(const String& spec, Bag& input, Bag& ret) {
+void cycle_sort(const SortStep& step, Bag& input, Bag& ret) {
+  const String& spec = step.chars;
   // count occurences of each item in spec
   vector<size_t> counts;
-  for(auto s : spec) {
-    counts.push_back(count_and_remove(s, input));
-  }
+  count_and_remove(step, input, counts);
   // determine best start point
   size_t best_start = 0;
   size_t best_start_score = 0xffffffff;
@@ -261,94 +442,68 @@ void in_place_sort(const String& spec, String& input, String& ret) {
 
 // ----------------------------------------------------------------------------- : spec_sort
 
-String spec_sort(const String& spec, String& input, String& ret) {
-  SpecIterator it(spec);
-  while(it.nextUntil(0)) {
-    if (it.escaped) { // single character, escaped
-      size_t count = count_and_remove(it.value, input);
-      ret.append(count, it.value);
-    } else if (it.value == _('<')) { // keep only a single copy
-      while (it.nextUntil(_('>'))) {
-        size_t pos = input.find_first_of(it.value);
-        if (pos != String::npos) {
-          input.erase(pos, 1);
-          ret += it.value; // input contains it.value
+void run_sort_program(const SortProgram& program, Bag& input, Bag& ret) {
+  vector<size_t> counts;
+  for (const SortStep& step : program) {
+    switch (step.type) {
+      case SortStep::COUNT:
+        count_and_remove(step, input, counts);
+        for (size_t i = 0 ; i < counts.size() ; ++i) {
+          ret.append(counts[i], step.chars[i]);
         }
-      }
-    } else if (it.keyword(_("once("))) {
-      while (it.nextUntil(_(')'))) {
-        size_t pos = input.find_first_of(it.value);
-        if (pos != String::npos) {
-          input.erase(pos, 1);
-          ret += it.value; // input contains it.value
+        break;
+      case SortStep::ONCE:
+        for (wxUniChar c : step.chars) {
+          size_t pos = input.find_first_of(c);
+          if (pos != String::npos) {
+            input.erase(pos, 1);
+            ret += c; // input contains c
+          }
         }
-      }
-      
-    } else if (it.value == _('[')) {  // in input order
-      mixed_sort(it.readParam(_(']')), input, ret);
-    } else if (it.keyword(_("mixed("))) {
-      mixed_sort(it.readParam(_(')')), input, ret);
-      
-    } else if (it.keyword(_("cycle("))) {
-      cycle_sort(it.readParam(_(')')), input, ret);
-    } else if (it.value == _('(')) {
-      cycle_sort(it.readParam(_(')')), input, ret);
-    
-    } else if (it.keyword(_("compound("))) { // compound item
-      compound_sort(it.readParam(_(')')), input, ret);
-    
-    } else if (it.keyword(_("pattern("))) { // recurse with pattern
-      String pattern;
-      // read pattern
-      while (it.nextUntil(_(' '), false)) {
-        if (it.value == _('.') && !it.escaped) {
-          pattern += PLACEHOLDER;
-        } else {
-          pattern += it.value;
+        break;
+      case SortStep::MIXED:
+        mixed_sort(step.chars, input, ret);
+        break;
+      case SortStep::CYCLE:
+        cycle_sort(step, input, ret);
+        break;
+      case SortStep::COMPOUND:
+        compound_sort(step.chars, input, ret);
+        break;
+      case SortStep::PATTERN:
+        pattern_sort(step.chars, step.sub_specs[0], input, ret);
+        break;
+      case SortStep::IN_PLACE:
+        in_place_sort(step.sub_specs[0], input, ret);
+        break;
+      case SortStep::ANY:
+        FOR_EACH_CONST(d, input) {
+          if (d != REMOVED) {
+            ret += d;
+          }
         }
-      }
-      // read spec to apply to pattern
-      String sub_spec = it.readRawParam(_(')'));
-      // sort
-      pattern_sort(pattern, sub_spec, input, ret);
-    
-    } else if (it.keyword(_("in_place("))) { // recurse without pattern
-      // read spec to apply to pattern
-      String sub_spec = it.readRawParam(_(')'));
-      in_place_sort(sub_spec, input, ret);
-    
-    } else if (it.keyword(_("any()"))) { // remaining input
-      FOR_EACH_CONST(d, input) {
-        if (d != REMOVED) {
-          ret += d;
+        input.clear();
+        break;
+      case SortStep::REVERSE_ORDER: {
+        vector<String> parts;
+        for (auto const& sub_spec : step.sub_specs) {
+          String part;
+          spec_sort(sub_spec, input, part);
+          parts.push_back(part);
         }
+        // add parts in reverse order
+        reverse(parts.begin(), parts.end());
+        for (auto const& part : parts) {
+          ret += part;
+        }
+        break;
       }
-      input.clear();
-    
-    } else if (it.keyword(_("reverse_order("))) { // reverse order of preference
-      vector<String> parts;
-      while (it.value != _(')')) {
-        String sub_spec = it.readRawParam(_(')'),_(' '));
-        String part;
-        spec_sort(sub_spec, input, part);
-        parts.push_back(part);
-      }
-      // add parts in reverse order
-      reverse(parts.begin(), parts.end());
-      for (auto const& part : parts) {
-        ret += part;
-      }
-    
-    } else if (it.keyword(_("ordered("))) { // in spec order
-      while (it.nextUntil(_(')'))) {
-        size_t count = count_and_remove(it.value, input);
-        ret.append(count, it.value);
-      }
-    } else { // single char
-      size_t count = count_and_remove(it.value, input);
-      ret.append(count, it.value);
     }
   }
+}
+
+String spec_sort(const String& spec, String& input, String& ret) {
+  run_sort_program(*sort_program_cache.get(spec), input, ret);
   return ret;
 }
 
@@ -14,8 +14,10 @@
 // ----------------------------------------------------------------------------- : Spell checker : construction
 
 map<String,SpellCheckerP> SpellChecker::spellers;
+mutex                     SpellChecker::spellers_mutex;
 
-SpellChecker* SpellChecker::get(const String& language) {
+SpellCheckerP SpellChecker::get(const String& language) {
+  lock_guard<mutex> guard(spellers_mutex);
   SpellCheckerP& speller = spellers[language];
   if (!speller) {
     String local_dir  = package_manager.getDictionaryDir(true);
@@ -30,10 +32,11 @@ SpellChecker* SpellChecker::get(const String& language) {
       queue_message(MESSAGE_ERROR, _("Dictionary not found for language: ") + language);
     }
   }
-  return speller.get();
+  return speller;
 }
 
-SpellChecker* SpellChecker::get(const String& filename, const String& language) {
+SpellCheckerP SpellChecker::get(const String& filename, const String& language) {
+  lock_guard<mutex> guard(spellers_mutex);
   SpellCheckerP& speller = spellers[filename + _(".") + language];
   if (!speller) {
     String prefix = package_manager.openFilenameFromPackage(nullptr, filename) + _(".");
@@ -54,7 +57,7 @@ SpellChecker* SpellChecker::get(const String& filename, const String& language)
       queue_message(MESSAGE_ERROR, _("Dictionary '") + filename + _("' not found for language: ") + language);
     }
   }
-  return speller.get();
+  return speller;
 }
 
 SpellChecker::SpellChecker(const char* aff_path, const char* dic_path)
@@ -63,6 +66,7 @@ SpellChecker::SpellChecker(const char* aff_path, const char* dic_path)
 {}
 
 void SpellChecker::destroyAll() {
+  lock_guard<mutex> guard(spellers_mutex);
   spellers.clear();
 }
 
@@ -104,12 +108,25 @@ bool SpellChecker::convert_encoding(const String& word, CharBuffer& out) {
 
 bool SpellChecker::spell(const String& word) {
   if (word.empty()) return true; // empty word is okay
+  lock_guard<mutex> guard(lock);
+  auto it = verdict_index.find(word);
+  if (it != verdict_index.end()) {
+    verdicts.splice(verdicts.begin(), verdicts, it->second);
+    return it->second->second;
+  }
   CharBuffer str;
-  if (!convert_encoding(word,str)) return false;
-  return Hunspell::spell(str);
+  bool correct = convert_encoding(word,str) && Hunspell::spell(str);
+  verdicts.emplace_front(word, correct);
+  verdict_index.emplace(word, verdicts.begin());
+  if (verdicts.size() > MAX_VERDICTS) {
+    verdict_index.erase(verdicts.back().first);
+    verdicts.pop_back();
+  }
+  return correct;
 }
 
 void SpellChecker::suggest(const String& word, vector<String>& suggestions_out) {
+  lock_guard<mutex> guard(lock);
   CharBuffer str;
   if (!convert_encoding(word,str)) return;
   // call Hunspell
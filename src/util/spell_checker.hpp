@@ -9,6 +9,8 @@
 // ----------------------------------------------------------------------------- : Includes
 
 #include <util/prec.hpp>
+#include <list>
+#include <mutex>
 #undef near
 #include "hunspell/hunspell.hxx"
 
@@ -27,17 +29,17 @@ class SpellChecker : public Hunspell, public IntrusivePtrBase<SpellChecker> {
 public:
   SpellChecker(const char* aff_path, const char* dic_path);
   /// Get a SpellChecker object for the given language.
-  /** Returns nullptr on error
-   *  Note: This is not threadsafe yet */
-  static SpellChecker* get(const String& language);
+  /** Returns nullptr on error */
+  static SpellCheckerP get(const String& language);
   /// Get a SpellChecker object for the given language and filename
-  /** Returns nullptr on error
-   *  Note: This is not threadsafe yet */
-  static SpellChecker* get(const String& filename, const String& language);
+  /** Returns nullptr on error */
+  static SpellCheckerP get(const String& filename, const String& language);
   /// Destroy all cached SpellChecker objects
+  /** Checkers that are still in use by another thread are destroyed when that thread is done with them */
   static void destroyAll();
 
   /// Check the spelling of a single word
+  /** The verdicts for recently checked words are remembered, card text uses the same words over and over */
   bool spell(const String& word);
 
   /// Give spelling suggestions
@@ -47,7 +49,14 @@ private:
   /// Convert between String and dictionary encoding
   wxCSConv encoding;
   bool convert_encoding(const String& word, CharBuffer& out);
-
-  static map<String,SpellCheckerP> spellers; //< Cached checkers for each language
+  
+  static const size_t MAX_VERDICTS = 10000;
+  typedef list<pair<String,bool>> Verdicts;
+  Verdicts                                  verdicts; ///< Recently checked words and whether they are correct, most recently used first
+  unordered_map<String, Verdicts::iterator> verdict_index;
+  mutex                                     lock;     ///< Hunspell and the verdicts are not threadsafe
+
+  static map<String,SpellCheckerP> spellers;       //< Cached checkers for each language
+  static mutex                     spellers_mutex; //< Card scripts are evaluated on multiple threads, see SetScriptManager::updateAllCards
 };
 
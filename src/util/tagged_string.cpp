@@ -30,35 +30,62 @@ bool is_tag_end_char(Char c) {
 }
 
 
+// The functions below work directly on the character buffer of the string,
+// so that runs of text between tags can be found and copied in bulk.
+// Offsets in that buffer are only the same as string indices if it stores whole characters.
+static_assert(sizeof(wxStringCharType) == sizeof(wxChar), "tagged strings must be stored as wide characters");
+
+typedef const wxStringCharType* CharPtr;
+
+// Find the first occurrence of c in [it, end), or end if there is none.
+// char_traits::find is a memchr/wmemchr, which the standard library implements with vector instructions.
+static inline CharPtr find_char(CharPtr it, CharPtr end, wxStringCharType c) {
+  CharPtr found = std::char_traits<wxStringCharType>::find(it, end - it, c);
+  return found ? found : end;
+}
+
+// Append [it, end) to ret, replacing escaped characters as untag_char does
+static void append_untag_chars(String& ret, CharPtr it, CharPtr end) {
+  CharPtr next_langle = find_char(it, end, ESCAPED_LANGLE);
+  CharPtr next_space  = find_char(it, end, CONNECTION_SPACE);
+  while (true) {
+    CharPtr next = min(next_langle, next_space);
+    ret.append(it, next - it);
+    if (next == end) return;
+    ret += untag_char(*next);
+    it = next + 1;
+    if (next == next_langle) next_langle = find_char(it, end, ESCAPED_LANGLE);
+    else                     next_space  = find_char(it, end, CONNECTION_SPACE);
+  }
+}
+
+// Append the parts of [it, end) that are not inside tags to ret
+template <bool untag_chars>
+static void append_untagged(String& ret, CharPtr it, CharPtr end) {
+  while (it != end) {
+    CharPtr tag = find_char(it, end, _('<'));
+    if (untag_chars) {
+      append_untag_chars(ret, it, tag);
+    } else {
+      ret.append(it, tag - it);
+    }
+    if (tag == end) return;
+    it = find_char(tag + 1, end, _('>'));
+    if (it != end) ++it;
+  }
+}
+
 String untag(const String& str) {
-  bool in_tag = false;
   String ret;
   ret.reserve(str.size());
-  for(wxUniChar c : str) {
-    if (c == _('<')) {
-      in_tag = true;
-    } else if (!in_tag) {
-      ret += untag_char(c);
-    } else if (c == _('>')) {
-      in_tag = false;
-    }
-  }
+  append_untagged<true>(ret, str.wx_str(), str.wx_str() + str.length());
   return ret;
 }
 
 String untag_no_escape(const String& str) {
-  bool in_tag = false;
   String ret;
   ret.reserve(str.size());
-  for (wxUniChar c : str) {
-    if (c == _('<')) {
-      in_tag = true;
-    } else if (!in_tag) {
-      ret += c;
-    } else if (c == _('>')) {
-      in_tag = false;
-    }
-  }
+  append_untagged<false>(ret, str.wx_str(), str.wx_str() + str.length());
   return ret;
 }
 
@@ -68,8 +95,13 @@ String untag_hide_sep(const String& str) {
 
 String escape(const String& str) {
   String ret; ret.reserve(str.size());
-  FOR_EACH_CONST(c, str) {
-    ret += tag_char(c);
+  CharPtr it = str.wx_str(), end = it + str.length();
+  while (true) {
+    CharPtr lt = find_char(it, end, _('<'));
+    ret.append(it, lt - it);
+    if (lt == end) break;
+    ret += ESCAPED_LANGLE;
+    it = lt + 1;
   }
   return ret;
 }
@@ -325,6 +357,61 @@ String anti_tag(const String& tag) {
 
 // ----------------------------------------------------------------------------- : Cursor position
 
+// Cursor position of an index that lies inside the atom or sep tag starting at i, with its close tag at close.
+// cursor is the cursor position before the atom.
+static size_t index_to_cursor_in_atom(const String& str, size_t i, size_t close, size_t index, size_t cursor, Movement dir) {
+  // This is the only place where MOVE_LEFT/RIGHT and MOVE_*_OPT differ
+  // for the OPT version we must check if we are actually past any real characters
+  // but, if the atom is empty, it still counts as a single character!
+  if (dir == MOVE_LEFT) {
+    return cursor;
+  } else if (dir == MOVE_RIGHT) {
+    return cursor + 1;
+  } else if (dir == MOVE_LEFT_OPT) {
+    // is there any non-tag after index?
+    bool empty = true;
+    while (i < close) {
+      Char c = str.GetChar(i);
+      if (c == _('<')) {
+        i = skip_tag(str, i);
+      } else if (i >= index) {
+        return cursor; // this is a non-tag character after index
+      } else {
+        empty = false;
+        ++i;
+      }
+    }
+    return empty ? cursor : cursor + 1; // still didn't pass any
+  } else if (dir == MOVE_RIGHT_OPT) {
+    // is index actually past any non-tag?
+    while (i < close) {
+      if (i >= index) {
+        return cursor; // we didn't pass any non-tag stuff
+      }
+      Char c = str.GetChar(i);
+      if (c != _('<')) break;
+      i = skip_tag(str, i);
+    }
+    return cursor + 1; // yes it is
+  } else {
+    // count number of actual characters before/after
+    int before_c = 0;
+    int after_c  = 0;
+    while (i < close) {
+      Char c = str.GetChar(i);
+      if (c == _('<')) {
+        i = skip_tag(str, i);
+      } else {
+        if (i < index) before_c++;
+        else           after_c++;
+        ++i;
+      }
+    }
+    // take the closest side
+    return before_c <= after_c ? cursor : cursor + 1;
+  }
+}
+
 size_t index_to_cursor(const String& str, size_t index, Movement dir) {
   size_t cursor = 0;
   index = min(index, str.size());
@@ -342,56 +429,7 @@ size_t index_to_cursor(const String& str, size_t index, Movement dir) {
         size_t after = skip_tag(str, close);
         if (index > before && index < after) {
           // Index is inside an atom, determine on which side we want the cursor
-          // This is the only place where MOVE_LEFT/RIGHT and MOVE_*_OPT differ
-          // for the OPT version we must check if we are actually past any real characters
-          // but, if the atom is empty, it still counts as a single character!
-          if (dir == MOVE_LEFT) {
-            return cursor;
-          } else if (dir == MOVE_RIGHT) {
-            return cursor + 1;
-          } else if (dir == MOVE_LEFT_OPT) {
-            // is there any non-tag after index?
-            bool empty = true;
-            while (i < close) {
-              c = str.GetChar(i);
-              if (c == _('<')) {
-                i = skip_tag(str, i);
-              } else if (i >= index) {
-                return cursor; // this is a non-tag character after index
-              } else {
-                empty = false;
-                ++i;
-              }
-            }
-            return empty ? cursor : cursor + 1; // still didn't pass any
-          } else if (dir == MOVE_RIGHT_OPT) {
-            // is index actually past any non-tag?
-            while (i < close) {
-              if (i >= index) {
-                return cursor; // we didn't pass any non-tag stuff
-              }
-              c = str.GetChar(i);
-              if (c != _('<')) break;
-              i = skip_tag(str, i);
-            }
-            return cursor + 1; // yes it is
-          } else if (dir == MOVE_MID) {
-            // count number of actual characters before/after
-            int before_c = 0;
-            int after_c  = 0;
-            while (i < close) {
-              c = str.GetChar(i);
-              if (c == _('<')) {
-                i = skip_tag(str, i);
-              } else {
-                if (i < index) before_c++;
-                else           after_c++;
-                ++i;
-              }
-            }
-            // take the closest side
-            return before_c <= after_c ? cursor : cursor + 1;
-          }
+          return index_to_cursor_in_atom(str, before, close, index, cursor, dir);
         }
         i = after;
       } else if (i == 0 && is_substr(str, i, _("<prefix"))) {
@@ -459,9 +497,8 @@ void cursor_to_index_range(const String& str, size_t cursor, size_t& start, size
   end = max(end, start + 1); // always start < end, since there are always valid cursor positions
 }
 
-size_t cursor_to_index(const String& str, size_t cursor, Movement dir) {
-  size_t start, end;
-  cursor_to_index_range(str, cursor, start, end);
+// Pick the character index in the range [start...end) of a cursor position
+static size_t cursor_range_to_index(const String& str, size_t start, size_t end, Movement dir) {
   assert(end <= str.size()+1);
   if (dir == MOVE_MID) {
     // find the middle between start and end
@@ -490,6 +527,83 @@ size_t cursor_to_index(const String& str, size_t cursor, Movement dir) {
   return dir <= 0 /*MOVE_LEFT*/ ? start : end - 1;
 }
 
+size_t cursor_to_index(const String& str, size_t cursor, Movement dir) {
+  size_t start, end;
+  cursor_to_index_range(str, cursor, start, end);
+  return cursor_range_to_index(str, start, end, dir);
+}
+
+// ----------------------------------------------------------------------------- : Cursor index
+
+CursorIndex::CursorIndex(const String& str)
+  : prefix_end(0)
+{
+  // the same walk over the string as cursor_to_index_range, but recording every position at once
+  size_t i = 0;
+  size = str.size(); // can be changed by <suffix> tags
+  while (i < size) {
+    Char c = str.GetChar(i);
+    size_t before = i;
+    bool has_width = true;
+    bool atom = false;
+    if (c == _('<')) {
+      // a tag
+      if (is_substr(str, i, _("<atom")) || is_substr(str, i, _("<sep"))) {
+        // tag counts as a single 'character'
+        i = match_close_tag_end(str, i);
+        atom = true;
+      } else if (i == 0 && is_substr(str, i, _("<prefix"))) {
+        prefix_end = i = match_close_tag_end(str,i);
+        has_width = false;
+      } else if (is_substr(str, i, _("<suffix")) && match_close_tag_end(str,i) >= str.size()) {
+        size = i;
+        has_width = false;
+      } else {
+        i = skip_tag(str, i);
+        has_width = false;
+      }
+    } else {
+      i++;
+    }
+    if (has_width) {
+      begins.push_back(before);
+      ends.push_back(i);
+      atoms.push_back(atom);
+    }
+  }
+  last_end = min(i, size);
+}
+
+size_t CursorIndex::indexToCursor(const String& text, size_t index, Movement dir) const {
+  assert(text.size() >= last_end);
+  index = min(index, text.size());
+  // is the index inside an atom? Only the last thing starting before index can contain it
+  size_t before = lower_bound(begins.begin(), begins.end(), index) - begins.begin();
+  if (before > 0 && atoms[before - 1] && index < ends[before - 1]) {
+    size_t atom_start = begins[before - 1];
+    return index_to_cursor_in_atom(text, atom_start, match_close_tag(text, atom_start), index, before - 1, dir);
+  }
+  // otherwise the cursor is after everything that ends before index
+  return upper_bound(ends.begin(), ends.end(), index) - ends.begin();
+}
+
+void CursorIndex::cursorToIndexRange(size_t cursor, size_t& start, size_t& end) const {
+  size_t count = begins.size();
+  if (cursor > count) {
+    start = end = size;
+  } else {
+    start = cursor == 0 ? prefix_end : ends[cursor - 1];
+    end   = cursor == count ? last_end : begins[cursor] + 1;
+  }
+  end = max(end, start + 1); // always start < end, since there are always valid cursor positions
+}
+
+size_t CursorIndex::cursorToIndex(const String& text, size_t cursor, Movement dir) const {
+  size_t start, end;
+  cursorToIndexRange(cursor, start, end);
+  return cursor_range_to_index(text, start, end, dir);
+}
+
 String untag_for_cursor(const String& str) {
   String ret; ret.reserve(str.size());
   for (size_t i = 0 ; i < str.size() ; ) {
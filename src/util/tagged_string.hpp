@@ -154,6 +154,28 @@ void cursor_to_index_range(const String& str, size_t cursor, size_t& begin, size
 /// Find the character index corresponding to the given cursor position
 size_t cursor_to_index(const String& str, size_t cursor, Movement dir = MOVE_MID);
 
+/// The cursor positions of a string, for converting between cursor positions and character indices many times.
+/** Gives the same results as index_to_cursor, cursor_to_index_range and cursor_to_index,
+ *  but after a single pass over the string each conversion takes O(log n) instead of O(n).
+ *  The string is not copied, it must be passed again to the conversions, and the owner must rebuild the index when it changes.
+ */
+class CursorIndex {
+public:
+  CursorIndex(const String& str);
+  
+  size_t indexToCursor(const String& str, size_t index, Movement dir = MOVE_MID) const;
+  void cursorToIndexRange(size_t cursor, size_t& start, size_t& end) const;
+  size_t cursorToIndex(const String& str, size_t cursor, Movement dir = MOVE_MID) const;
+  
+private:
+  vector<size_t> begins; ///< Start index of each character/atom/sep that takes up a cursor position
+  vector<size_t> ends;   ///< End index of each character/atom/sep that takes up a cursor position
+  vector<bool>   atoms;  ///< Is the thing at each cursor position an atom or sep?
+  size_t prefix_end;     ///< End of the <prefix> at the start of the string, or 0
+  size_t size;           ///< Size of the string without the <suffix> at the end
+  size_t last_end;       ///< End index of the range of the last cursor position
+};
+
 
 const Char UNTAG_ATOM       = _('\2');
 const Char UNTAG_SEP        = _('\3');